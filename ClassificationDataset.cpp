@@ -1,35 +1,76 @@
 #include "ClassificationDataset.h"
 #include "image_loader.h"
-#include "itkImageRegionConstIteratorWithIndex.h"
 #include "log4cxx/logger.h"
-#include <cstdlib> // rand()
+#include "itkObjectFactoryBase.h"
+#include "MappedFile.h"
+#include <boost/filesystem.hpp>
+#include <cstring> // memcpy(), memcmp()
+#include <fstream>
+#include <algorithm>
 
 template <typename TInputValueType>
-void ClassificationDataset<TInputValueType>::init(const int number_of_classes)
+const char ClassificationDataset<TInputValueType>::FileMagic[8] = { 'I', 'S', 'G', 'C', 'R', 'D', 'S', '\0' };
+
+template <typename TInputValueType>
+size_t ClassificationDataset<TInputValueType>::align_offset(const size_t offset)
+{
+	return (offset + Matrix::Alignment - 1) / Matrix::Alignment * Matrix::Alignment;
+}
+
+template <typename TInputValueType>
+void ClassificationDataset<TInputValueType>::init(const int number_of_classes, const size_t max_samples_per_class, const uint64_t seed)
 {
 	m_NumberOfClasses = number_of_classes;
-	m_Classes = ClassVector(number_of_classes, Class());
+	m_Matrices = MatrixVector();
+	m_Indices = IndexVectorVector(number_of_classes, IndexVector());
 	m_InputSize = 0;
+	m_MaxSamplesPerClass = max_samples_per_class;
+	m_Seed = seed;
+	m_NumberOfSeenSamples = std::vector< size_t >(number_of_classes, 0);
 }
 
 template <typename TInputValueType>
-ClassificationDataset<TInputValueType>::ClassificationDataset(typename FeaturesImage::Pointer image, const std::vector< std::string > &class_filenames)
+ClassificationDataset<TInputValueType>::ClassificationDataset(typename FeaturesImage::Pointer image, const std::vector< std::string > &class_filenames,
+                                                              const size_t max_samples_per_class, const uint64_t seed)
 {
-	init(class_filenames.size());
+	init(class_filenames.size(), max_samples_per_class, seed);
 
 	load_image(image, class_filenames);
 }
 
 template <typename TInputValueType>
-ClassificationDataset<TInputValueType>::ClassificationDataset(const std::vector< std::string > &images_filenames, const std::vector< std::string > &classes_filenames)
+ClassificationDataset<TInputValueType>::ClassificationDataset(const int number_of_classes, const size_t max_samples_per_class, const uint64_t seed)
+{
+	init(number_of_classes, max_samples_per_class, seed);
+}
+
+template <typename TInputValueType>
+ClassificationDataset<TInputValueType>::ClassificationDataset(const std::vector< std::string > &images_filenames, const std::vector< std::string > &classes_filenames,
+                                                              const size_t max_samples_per_class, const uint64_t seed)
 {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
 	const int number_of_classes = classes_filenames.size() / images_filenames.size();
 
-	init(number_of_classes);
+	const int number_of_images = images_filenames.size();
+
+	init(number_of_classes, max_samples_per_class, seed);
 
-	for(int i = 0; i < images_filenames.size(); ++i) {
+	// Make sure ITK's factories are registered before the readers are created concurrently.
+	itk::ObjectFactoryBase::GetRegisteredFactories();
+
+	/*
+	 * Each image is loaded (with its masks) and its samples are extracted by one thread.
+	 * The partial datasets are then merged in the order of the images, so the resulting
+	 * dataset does not depend on the number of threads.
+	 * When the number of samples is limited, each partial dataset is sampled with its own
+	 * generator, and is limited as well, so that the memory is bounded.
+	 */
+	std::vector< boost::shared_ptr< ClassificationDataset<TInputValueType> > > partial_datasets(number_of_images);
+	std::vector< std::string > errors(number_of_images);
+
+	#pragma omp parallel for schedule(dynamic) if(number_of_images > 1)
+	for(int i = 0; i < number_of_images; ++i) {
 		LOG4CXX_INFO(logger, "Loading image #" << i << " from " << images_filenames[i]);
 
 		std::vector< std::string > training_classes(
@@ -37,33 +78,179 @@ ClassificationDataset<TInputValueType>::ClassificationDataset(const std::vector<
 			classes_filenames.begin() + (i+1) * number_of_classes
 		);
 
-		load_image(images_filenames[i], training_classes);
+		try {
+			boost::shared_ptr< ClassificationDataset<TInputValueType> > partial_dataset(
+				new ClassificationDataset(number_of_classes, max_samples_per_class, RandomGenerator::derive(seed, i)));
+			partial_dataset->load_image(images_filenames[i], training_classes);
+			partial_datasets[i] = partial_dataset;
+		} catch (std::exception &ex) {
+			errors[i] = ex.what();
+		}
+	}
+
+	for(int i = 0; i < number_of_images; ++i) {
+		if(!errors[i].empty())
+			throw ClassificationDatasetException(errors[i]);
+	}
+
+	if(m_MaxSamplesPerClass > 0) {
+		merge_samples(partial_datasets);
+	} else {
+		append(partial_datasets);
 	}
 }
 
 template <typename TInputValueType>
-ClassificationDataset<TInputValueType>::ClassificationDataset(ClassVector *classes, const int number_of_classes, const int input_size) :
-	m_NumberOfClasses(number_of_classes),
+void ClassificationDataset<TInputValueType>::append(std::vector< boost::shared_ptr< ClassificationDataset<TInputValueType> > > &datasets)
+{
+	if(datasets.empty())
+		return;
+
+	for(size_t d = 0; d < datasets.size(); ++d) {
+		if(m_InputSize == 0) {
+			m_InputSize = datasets[d]->m_InputSize;
+		} else if(m_InputSize != datasets[d]->m_InputSize)
+			throw ClassificationDatasetException("The image has a number of components which is unexpected.");
+	}
+
+	if(m_Matrices.empty()) {
+		for(int i = 0; i < m_NumberOfClasses; ++i)
+			m_Matrices.push_back(boost::shared_ptr< Matrix >(new Matrix(m_InputSize)));
+	}
+
+	// The matrices are allocated once, instead of growing with each dataset.
+	for(int i = 0; i < m_NumberOfClasses; ++i)
+	{
+		size_t number_of_rows = m_Matrices[i]->getNumberOfRows();
+		for(size_t d = 0; d < datasets.size(); ++d)
+			number_of_rows += datasets[d]->m_Indices[i].size();
+
+		m_Matrices[i]->reserve(number_of_rows);
+		m_Indices[i].reserve(number_of_rows);
+	}
+
+	for(size_t d = 0; d < datasets.size(); ++d)
+	{
+		const ClassificationDataset<TInputValueType> &other = *(datasets[d]);
+
+		for(int i = 0; i < m_NumberOfClasses; ++i)
+		{
+			const Class c = other.getClass(i);
+			Matrix &matrix = *(m_Matrices[i]);
+
+			m_NumberOfSeenSamples[i] += other.m_NumberOfSeenSamples[i];
+			IndexVector &indices = m_Indices[i];
+
+			const size_t first_row_index = matrix.getNumberOfRows();
+			InputValueType *row = matrix.appendRows(c.size());
+
+			for(size_t j = 0; j < c.size(); ++j, row += m_InputSize)
+			{
+				std::copy(c[j], c[j] + m_InputSize, row);
+				indices.push_back(first_row_index + j);
+			}
+		}
+
+		datasets[d].reset();
+	}
+}
+
+template <typename TInputValueType>
+ClassificationDataset<TInputValueType>::ClassificationDataset(const MatrixVector &matrices, IndexVectorVector &indices, const int number_of_classes, const int input_size) :
 	m_InputSize(input_size),
-	m_Classes(*classes)
-{}
+	m_NumberOfClasses(number_of_classes),
+	m_Matrices(matrices),
+	m_Indices(),
+	m_MaxSamplesPerClass(0),
+	m_Seed(0),
+	m_NumberOfSeenSamples(number_of_classes, 0)
+{
+	m_Indices.swap(indices);
+}
+
+/**
+ * Dataset d holds a uniform sample of m_d patterns among the n_d pixels of its masks.
+ * Each pattern of the merged sample is drawn from dataset d with a probability proportional
+ * to the number of pixels of d not drawn yet (which produces a uniform sample of the union
+ * of the pixels), and is picked at random among the patterns of d not drawn yet.
+ * No more than m_d patterns can be drawn from d, since no more than min(n_d, max) are drawn.
+ */
+template <typename TInputValueType>
+void ClassificationDataset<TInputValueType>::merge_samples(const std::vector< boost::shared_ptr< ClassificationDataset<TInputValueType> > > &datasets)
+{
+	const int number_of_datasets = datasets.size();
+
+	RandomGenerator generator(RandomGenerator::derive(m_Seed, number_of_datasets));
+
+	for(int d = 0; d < number_of_datasets; ++d) {
+		if(m_InputSize == 0) {
+			m_InputSize = datasets[d]->m_InputSize;
+		} else if(m_InputSize != datasets[d]->m_InputSize)
+			throw ClassificationDatasetException("The image has a number of components which is unexpected.");
+	}
+
+	for(int i = 0; i < m_NumberOfClasses; ++i)
+		m_Matrices.push_back(boost::shared_ptr< Matrix >(new Matrix(m_InputSize)));
+
+	for(int i = 0; i < m_NumberOfClasses; ++i)
+	{
+		std::vector< size_t > remaining(number_of_datasets);
+		IndexVectorVector candidates(number_of_datasets);
+		size_t total_remaining = 0;
+
+		for(int d = 0; d < number_of_datasets; ++d) {
+			remaining[d] = datasets[d]->m_NumberOfSeenSamples[i];
+			candidates[d] = datasets[d]->m_Indices[i];
+			total_remaining += remaining[d];
+		}
+
+		m_NumberOfSeenSamples[i] = total_remaining;
+
+		const size_t number_of_samples = std::min(m_MaxSamplesPerClass, total_remaining);
+
+		Matrix &matrix = *(m_Matrices[i]);
+		InputValueType *row = matrix.appendRows(number_of_samples);
+
+		m_Indices[i].reserve(number_of_samples);
+
+		std::vector< size_t > drawn(number_of_datasets, 0);
+
+		for(size_t s = 0; s < number_of_samples; ++s, row += m_InputSize)
+		{
+			uint64_t u = generator.uniform(total_remaining);
+			int d = 0;
+			while(u >= remaining[d]) {
+				u -= remaining[d];
+				++d;
+			}
+
+			--remaining[d];
+			--total_remaining;
+
+			IndexVector &c = candidates[d];
+			std::swap(c[drawn[d]], c[drawn[d] + generator.uniform(c.size() - drawn[d])]);
+
+			const InputValueType *source = datasets[d]->m_Matrices[i]->getRow(c[drawn[d]]);
+			std::copy(source, source + m_InputSize, row);
+			++drawn[d];
+
+			m_Indices[i].push_back(s);
+		}
+	}
+}
 
 template <typename TInputValueType>
 void ClassificationDataset<TInputValueType>::load_image(const std::string image_filename, const std::vector< std::string > class_filenames)
 {
-	typename itk::ImageFileReader< FeaturesImage >::Pointer reader = itk::ImageFileReader< FeaturesImage >::New();
-	reader->SetFileName(image_filename);
+	typename FeaturesImage::Pointer image;
 
 	try {
-		reader->Update();
-	} catch( itk::ExceptionObject &ex ) {
-		std::stringstream err;
-		err << "ITK is unable to load the image \"" << image_filename << "\" (" << ex.what() << ")";
-
-		throw ClassificationDatasetException(err.str());
+		image = ImageLoader::loadFeatures(image_filename);
+	} catch (ImageLoadingException & ex) {
+		throw ClassificationDatasetException(ex.what());
 	}
 
-	this->load_image(reader->GetOutput(), class_filenames);
+	this->load_image(image, class_filenames);
 }
 
 template <typename TInputValueType>
@@ -71,62 +258,202 @@ void ClassificationDataset<TInputValueType>::load_image(typename FeaturesImage::
 {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
-	if(m_InputSize== 0)
-		m_InputSize= image->GetNumberOfComponentsPerPixel();
-	else if(m_InputSize != image->GetNumberOfComponentsPerPixel())
+	if(m_InputSize == 0) {
+		m_InputSize = image->GetNumberOfComponentsPerPixel();
+
+		for(int i = 0; i < m_NumberOfClasses; ++i)
+			m_Matrices.push_back(boost::shared_ptr< Matrix >(new Matrix(m_InputSize)));
+	} else if(m_InputSize != image->GetNumberOfComponentsPerPixel())
 		throw ClassificationDatasetException("The image has a number of components which is unexpected.");
 
 	/**
 	  * Loading the classes.
-	  * For each class we build a vector of the pixels
-	  * to be used during learning.
 	  */
+	std::vector< ImageType::Pointer > class_images(m_NumberOfClasses);
+	std::vector< std::string > errors(m_NumberOfClasses);
+
+	itk::ObjectFactoryBase::GetRegisteredFactories();
+
+	#pragma omp parallel for schedule(dynamic)
 	for(int i = 0; i < m_NumberOfClasses; ++i)
 	{
 		LOG4CXX_INFO(logger, "Loading class from " << class_filenames[i]);
 
-		ImageType::Pointer class_image;
-
 		// Load the class image
 		try {
-			class_image = ImageLoader::load(class_filenames[i]);
+			class_images[i] = ImageLoader::load(class_filenames[i]);
 		} catch (ImageLoadingException & ex) {
-			throw ClassificationDatasetException(ex.what());
+			errors[i] = ex.what();
+			continue;
 		} 
 
 		// check the class image dimensions
-		if(class_image->GetLargestPossibleRegion().GetSize() != image->GetLargestPossibleRegion().GetSize()) {
+		if(class_images[i]->GetLargestPossibleRegion().GetSize() != image->GetLargestPossibleRegion().GetSize()) {
 			std::stringstream err;
-			err << "The dimensions of the class image \"" << class_filenames[i] << "\" (" << class_image->GetLargestPossibleRegion().GetSize()
+			err << "The dimensions of the class image \"" << class_filenames[i] << "\" (" << class_images[i]->GetLargestPossibleRegion().GetSize()
 			    << ") differs from the dimensions of the image (" << image->GetLargestPossibleRegion().GetSize() << ")";
 
-			throw ClassificationDatasetException(err.str());
+			errors[i] = err.str();
+			continue;
 		}
 
-		Class &current_class = m_Classes[i];
+		LOG4CXX_INFO(logger, "Learning class loaded from " << class_filenames[i]);
+	}
+
+	for(int i = 0; i < m_NumberOfClasses; ++i) {
+		if(!errors[i].empty())
+			throw ClassificationDatasetException(errors[i]);
+	}
 
-		typename itk::ImageRegionConstIteratorWithIndex< ImageType > classIterator(class_image, class_image->GetLargestPossibleRegion());
-		while(!classIterator.IsAtEnd())
+	extract_samples(image, class_images);
+}
+
+/**
+ * The masks and the features image share the same geometry, so the pixel selected
+ * at offset p in a mask has its features at offset p * m_InputSize in the buffer of
+ * the features image.
+ *
+ * The masks are processed by chunks of pixels, in two parallel passes. The first one counts
+ * the pixels selected by every mask in every chunk, which gives the row at which each chunk
+ * starts writing in the matrix of each class. The second one copies the features.
+ * The rows are stored in the order of the pixels, whatever the number of threads.
+ */
+template <typename TInputValueType>
+void ClassificationDataset<TInputValueType>::extract_samples(typename FeaturesImage::Pointer image, const std::vector< ImageType::Pointer > &class_images)
+{
+	if(image->GetBufferedRegion() != image->GetLargestPossibleRegion())
+		throw ClassificationDatasetException("The features image is not entirely loaded in memory.");
+
+	const long number_of_pixels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+	const long chunk_size = 1 << 16;
+	const long number_of_chunks = (number_of_pixels + chunk_size - 1) / chunk_size;
+
+	const FeaturesImage::InternalPixelType *features = image->GetBufferPointer();
+
+	std::vector< const ImageType::PixelType* > masks(m_NumberOfClasses);
+	for(int i = 0; i < m_NumberOfClasses; ++i)
+		masks[i] = class_images[i]->GetBufferPointer();
+
+	// counts[k * m_NumberOfClasses + i] is the number of pixels of the chunk k selected by the mask i.
+	std::vector< size_t > counts(number_of_chunks * m_NumberOfClasses, 0);
+
+	#pragma omp parallel for schedule(static)
+	for(long k = 0; k < number_of_chunks; ++k)
+	{
+		const long begin = k * chunk_size,
+		           end   = std::min(begin + chunk_size, number_of_pixels);
+
+		for(int i = 0; i < m_NumberOfClasses; ++i)
+		{
+			const ImageType::PixelType *mask = masks[i];
+			size_t count = 0;
+
+			for(long p = begin; p < end; ++p)
+				count += (255 == mask[p]);
+
+			counts[k * m_NumberOfClasses + i] = count;
+		}
+	}
+
+	/*
+	 * Turn the counts into the rank of the first selected pixel of each chunk, and allocate the rows.
+	 * When a class has too many pixels, the ranks of the pixels to keep are drawn first
+	 * (reservoir sampling over the ranks), so that only those pixels are copied.
+	 */
+	std::vector< InputValueType* > first_rows(m_NumberOfClasses);
+	IndexVectorVector sampled_ranks(m_NumberOfClasses);
+
+	RandomGenerator generator(m_Seed);
+
+	for(int i = 0; i < m_NumberOfClasses; ++i)
+	{
+		size_t total = 0;
+		for(long k = 0; k < number_of_chunks; ++k)
 		{
-			if(255 == classIterator.Get()) {
-				const typename FeaturesImage::PixelType raw_values = image->GetPixel(classIterator.GetIndex());
+			const size_t count = counts[k * m_NumberOfClasses + i];
+			counts[k * m_NumberOfClasses + i] = total;
+			total += count;
+		}
+
+		m_NumberOfSeenSamples[i] += total;
+
+		if((m_MaxSamplesPerClass > 0) && (total > m_MaxSamplesPerClass)) {
+			IndexVector &ranks = sampled_ranks[i];
+			ranks.resize(m_MaxSamplesPerClass);
 
-				InputType values(raw_values.GetDataPointer(), raw_values.GetDataPointer() + m_InputSize);
+			for(size_t r = 0; r < m_MaxSamplesPerClass; ++r)
+				ranks[r] = r;
 
-				current_class.push_back(values);
+			for(size_t r = m_MaxSamplesPerClass; r < total; ++r) {
+				const uint64_t j = generator.uniform(r + 1);
+				if(j < m_MaxSamplesPerClass)
+					ranks[j] = r;
 			}
 
-			++classIterator;
+			std::sort(ranks.begin(), ranks.end());
+
+			total = m_MaxSamplesPerClass;
 		}
 
-		LOG4CXX_INFO(logger, "Learning class loaded from " << class_filenames[i]);
+		Matrix &matrix = *(m_Matrices[i]);
+		IndexVector &indices = m_Indices[i];
+
+		const size_t first_row_index = matrix.getNumberOfRows();
+		matrix.appendRows(total);
+		first_rows[i] = matrix.getRow(first_row_index);
+
+		indices.reserve(indices.size() + total);
+		for(size_t r = 0; r < total; ++r)
+			indices.push_back(first_row_index + r);
+	}
+
+	// The features are converted from the type of the image to InputValueType while being copied.
+	#pragma omp parallel for schedule(static)
+	for(long k = 0; k < number_of_chunks; ++k)
+	{
+		const long begin = k * chunk_size,
+		           end   = std::min(begin + chunk_size, number_of_pixels);
+
+		for(int i = 0; i < m_NumberOfClasses; ++i)
+		{
+			const ImageType::PixelType *mask = masks[i];
+			const IndexVector &ranks = sampled_ranks[i];
+
+			if(ranks.empty()) {
+				InputValueType *row = first_rows[i] + counts[k * m_NumberOfClasses + i] * m_InputSize;
+
+				for(long p = begin; p < end; ++p)
+				{
+					if(255 == mask[p]) {
+						const FeaturesImage::InternalPixelType *pixel_features = features + p * m_InputSize;
+						std::copy(pixel_features, pixel_features + m_InputSize, row);
+						row += m_InputSize;
+					}
+				}
+			} else {
+				size_t rank = counts[k * m_NumberOfClasses + i];
+				size_t s = std::lower_bound(ranks.begin(), ranks.end(), rank) - ranks.begin();
+
+				for(long p = begin; (p < end) && (s < ranks.size()); ++p)
+				{
+					if(255 == mask[p]) {
+						if(ranks[s] == rank) {
+							const FeaturesImage::InternalPixelType *pixel_features = features + p * m_InputSize;
+							std::copy(pixel_features, pixel_features + m_InputSize, first_rows[i] + s * m_InputSize);
+							++s;
+						}
+						++rank;
+					}
+				}
+			}
+		}
 	}
 }
 
 template <typename TInputValueType>
-const typename ClassificationDataset<TInputValueType>::Class& ClassificationDataset<TInputValueType>::getClass(const int c) const
+typename ClassificationDataset<TInputValueType>::Class ClassificationDataset<TInputValueType>::getClass(const int c) const
 {
-	return m_Classes[c];
+	return Class(m_Matrices[c].get(), &(m_Indices[c]));
 }
 
 template <typename TInputValueType>
@@ -173,38 +500,187 @@ template <typename TInputValueType>
 std::pair< boost::shared_ptr< ClassificationDataset<TInputValueType> >, boost::shared_ptr< ClassificationDataset<TInputValueType> > >
 ClassificationDataset<TInputValueType>::split(const float ratio) const
 {
-	ClassVector cv1(m_NumberOfClasses, Class()),
-	            cv2(m_NumberOfClasses, Class());
+	IndexVectorVector iv1(m_NumberOfClasses, IndexVector()),
+	                  iv2(m_NumberOfClasses, IndexVector());
 
 	for(int i = 0; i < m_NumberOfClasses; ++i)
 	{
-		const int number_of_elements = getClass(i).size();
+		const IndexVector &indices = m_Indices[i];
+		const int number_of_elements = indices.size();
 		const int first_set_size     = round( number_of_elements * ratio );
 		const int second_set_size    = number_of_elements - first_set_size;
 
 		if((0 == first_set_size) || (0 == second_set_size))
 			throw ClassificationDatasetException("Cannot split this ClassificationDataset. The ratio will ends-up generating an empty set.");
 
-		cv1[i].insert(cv1[i].end(), getClass(i).begin(), getClass(i).begin() + first_set_size);
-		cv2[i].insert(cv2[i].end(), getClass(i).begin() + first_set_size, getClass(i).end());
+		iv1[i].assign(indices.begin(), indices.begin() + first_set_size);
+		iv2[i].assign(indices.begin() + first_set_size, indices.end());
 	}
 
 	return std::make_pair(
-		new ClassificationDataset(&cv1, m_NumberOfClasses, m_InputSize),
-		new ClassificationDataset(&cv2, m_NumberOfClasses, m_InputSize)
+		boost::shared_ptr< ClassificationDataset<TInputValueType> >(new ClassificationDataset(m_Matrices, iv1, m_NumberOfClasses, m_InputSize)),
+		boost::shared_ptr< ClassificationDataset<TInputValueType> >(new ClassificationDataset(m_Matrices, iv2, m_NumberOfClasses, m_InputSize))
 		);
 }
 
 template <typename TInputValueType>
-void ClassificationDataset<TInputValueType>::shuffle()
+void ClassificationDataset<TInputValueType>::shuffle(const uint64_t seed)
 {
+	#pragma omp parallel for schedule(dynamic)
 	for(int i = 0; i < m_NumberOfClasses; ++i)
 	{
-		Class &c = m_Classes[i];
-		for(int j = c.size() - 1; j > 0; --j)
+		RandomGenerator generator(RandomGenerator::derive(seed, i));
+
+		IndexVector &indices = m_Indices[i];
+		for(size_t j = indices.size(); j > 1; --j)
 		{
-			c[j].swap(c[std::rand() % (j+1)]);
+			std::swap(indices[j - 1], indices[generator.uniform(j)]);
 		}
 	}
 }
 
+
+template <typename TInputValueType>
+void ClassificationDataset<TInputValueType>::save(const std::string &filename) const
+{
+	const boost::filesystem::path target(filename);
+	boost::filesystem::path temporary_filename;
+
+	std::ofstream file;
+	file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	try {
+		// The temporary file is unique, so concurrent writers of the same file do not share it.
+		temporary_filename = target.parent_path() / boost::filesystem::unique_path(target.filename().native() + ".%%%%-%%%%-%%%%.tmp");
+		file.open(temporary_filename.native().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+		const uint32_t version = FileVersion, value_size = sizeof(InputValueType);
+		const uint64_t input_size = m_InputSize, number_of_classes = m_NumberOfClasses;
+
+		file.write(FileMagic, sizeof(FileMagic));
+		file.write(reinterpret_cast< const char* >(&version), sizeof(version));
+		file.write(reinterpret_cast< const char* >(&value_size), sizeof(value_size));
+		file.write(reinterpret_cast< const char* >(&input_size), sizeof(input_size));
+		file.write(reinterpret_cast< const char* >(&number_of_classes), sizeof(number_of_classes));
+
+		for(int i = 0; i < m_NumberOfClasses; ++i) {
+			const uint64_t number_of_rows = m_Indices[i].size(), number_of_seen_samples = m_NumberOfSeenSamples[i];
+			file.write(reinterpret_cast< const char* >(&number_of_rows), sizeof(number_of_rows));
+			file.write(reinterpret_cast< const char* >(&number_of_seen_samples), sizeof(number_of_seen_samples));
+		}
+
+		const std::vector< char > padding(align_offset(1), 0);
+
+		for(int i = 0; i < m_NumberOfClasses; ++i) {
+			const size_t position = file.tellp();
+			file.write(&(padding[0]), align_offset(position) - position);
+
+			const Class c = getClass(i);
+			for(size_t j = 0; j < c.size(); ++j)
+				file.write(reinterpret_cast< const char* >(c[j]), m_InputSize * sizeof(InputValueType));
+		}
+
+		file.close();
+
+		boost::filesystem::rename(temporary_filename, filename);
+	} catch(std::ofstream::failure &e) {
+		boost::system::error_code ignored;
+		boost::filesystem::remove(temporary_filename, ignored);
+		throw ClassificationDatasetException("Cannot write the dataset " + filename + " (" + e.what() + ")");
+	} catch(boost::filesystem::filesystem_error &e) {
+		boost::system::error_code ignored;
+		boost::filesystem::remove(temporary_filename, ignored);
+		throw ClassificationDatasetException("Cannot write the dataset " + filename + " (" + e.what() + ")");
+	}
+}
+
+template <typename TInputValueType>
+boost::shared_ptr< ClassificationDataset<TInputValueType> > ClassificationDataset<TInputValueType>::load(const std::string &filename)
+{
+	boost::shared_ptr< MappedFile > mapping;
+
+	try {
+		mapping = MappedFile::open(filename);
+	} catch(MappedFileException &e) {
+		throw ClassificationDatasetException(e.what());
+	}
+
+	const char *data = mapping->data();
+	const size_t size = mapping->size();
+
+	uint32_t version, value_size;
+	uint64_t input_size, number_of_classes;
+	const size_t header_size = sizeof(FileMagic) + sizeof(version) + sizeof(value_size) + sizeof(input_size) + sizeof(number_of_classes);
+
+	if(size < header_size || memcmp(data, FileMagic, sizeof(FileMagic)) != 0)
+		throw ClassificationDatasetException("Invalid dataset " + filename);
+
+	size_t offset = sizeof(FileMagic);
+	memcpy(&version, data + offset, sizeof(version));           offset += sizeof(version);
+	memcpy(&value_size, data + offset, sizeof(value_size));     offset += sizeof(value_size);
+	memcpy(&input_size, data + offset, sizeof(input_size));     offset += sizeof(input_size);
+	memcpy(&number_of_classes, data + offset, sizeof(number_of_classes)); offset += sizeof(number_of_classes);
+
+	if(version != FileVersion || value_size != sizeof(InputValueType))
+		throw ClassificationDatasetException("Unsupported dataset " + filename);
+
+	if(size < offset + number_of_classes * 2 * sizeof(uint64_t))
+		throw ClassificationDatasetException("Invalid dataset " + filename);
+
+	boost::shared_ptr< ClassificationDataset<TInputValueType> > dataset(new ClassificationDataset(number_of_classes, 0, 0));
+	dataset->m_InputSize = input_size;
+
+	std::vector< uint64_t > numbers_of_rows(number_of_classes);
+	for(size_t i = 0; i < number_of_classes; ++i) {
+		uint64_t number_of_seen_samples;
+		memcpy(&(numbers_of_rows[i]), data + offset, sizeof(uint64_t));    offset += sizeof(uint64_t);
+		memcpy(&number_of_seen_samples, data + offset, sizeof(uint64_t)); offset += sizeof(uint64_t);
+		dataset->m_NumberOfSeenSamples[i] = number_of_seen_samples;
+	}
+
+	for(size_t i = 0; i < number_of_classes; ++i) {
+		offset = align_offset(offset);
+
+		const size_t block_size = numbers_of_rows[i] * input_size * sizeof(InputValueType);
+		if(size < offset + block_size)
+			throw ClassificationDatasetException("Truncated dataset " + filename);
+
+		InputValueType *rows = reinterpret_cast< InputValueType* >(mapping->data() + offset);
+		dataset->m_Matrices.push_back(boost::shared_ptr< Matrix >(new Matrix(input_size, numbers_of_rows[i], rows, mapping)));
+
+		IndexVector &indices = dataset->m_Indices[i];
+		indices.resize(numbers_of_rows[i]);
+		for(size_t r = 0; r < indices.size(); ++r)
+			indices[r] = r;
+
+		offset += block_size;
+	}
+
+	return dataset;
+}
+
+template <typename TInputValueType>
+boost::shared_ptr< FeatureScaler<TInputValueType> > ClassificationDataset<TInputValueType>::computeScaler(const typename FeatureScaler<InputValueType>::Method method) const
+{
+	std::vector< const Matrix* > matrices;
+	for(typename MatrixVector::const_iterator it = m_Matrices.begin(); it != m_Matrices.end(); ++it)
+		matrices.push_back(it->get());
+
+	try {
+		return FeatureScaler<InputValueType>::fit(matrices, method);
+	} catch(FeatureScalerException &e) {
+		throw ClassificationDatasetException(e.what());
+	}
+}
+
+template <typename TInputValueType>
+void ClassificationDataset<TInputValueType>::scale(const FeatureScaler<InputValueType> &scaler)
+{
+	for(typename MatrixVector::iterator it = m_Matrices.begin(); it != m_Matrices.end(); ++it) {
+		try {
+			scaler.transform(**it);
+		} catch(FeatureScalerException &e) {
+			throw ClassificationDatasetException(e.what());
+		}
+	}
+}
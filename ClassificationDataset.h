@@ -2,6 +2,9 @@
 #define CLASSIFICATIONDATASET_H
 
 #include "common.h"
+#include "FeatureMatrix.h"
+#include "FeatureScaler.h"
+#include "RandomGenerator.h"
 
 #include <boost/shared_ptr.hpp>
 #include <vector>
@@ -32,12 +35,38 @@ public:
 	/** InputType represents a texture feature. */
 	typedef std::vector< InputValueType > InputType;
 
-	/** A Class is a set of texture features. */
-	typedef std::vector< InputType > Class;
+	/** The storage of the texture features of a class, one per row. */
+	typedef FeatureMatrix< InputValueType > Matrix;
+
+	/** A list of indices of rows of a Matrix. */
+	typedef std::vector< size_t > IndexVector;
+
+	/**
+	 * A Class is a set of texture features. It is a view on some rows of a Matrix,
+	 * it remains valid as long as the ClassificationDataset is not modified.
+	 */
+	class Class
+	{
+	public:
+		Class(const Matrix *matrix, const IndexVector *indices) : m_Matrix(matrix), m_Indices(indices) {}
+
+		size_t size() const { return m_Indices->size(); }
+		bool empty() const { return m_Indices->empty(); }
+
+		/** Returns the i-th texture feature of the class. */
+		const InputValueType* operator[](const size_t i) const { return m_Matrix->getRow((*m_Indices)[i]); }
+
+		const Matrix& getMatrix() const { return *m_Matrix; }
+		const IndexVector& getIndices() const { return *m_Indices; }
+
+	private:
+		const Matrix *m_Matrix;
+		const IndexVector *m_Indices;
+	};
 
 private:
-	/** Datatype representing a list of class. */
-	typedef std::vector< Class > ClassVector;
+	typedef std::vector< boost::shared_ptr< Matrix > > MatrixVector;
+	typedef std::vector< IndexVector > IndexVectorVector;
 
 public:
 	/**
@@ -46,8 +75,12 @@ public:
 	 *
 	 * @param image The image that holds the features.
 	 * @param class_filenames The filenames of the masks.
+	 * @param max_samples_per_class The maximum number of patterns per class (0: no limit).
+	 *        The patterns are uniformly sampled among the pixels of the masks.
+	 * @param seed The seed used to sample the patterns.
 	 */
-	ClassificationDataset(typename FeaturesImage::Pointer image, const std::vector< std::string > &class_filenames);
+	ClassificationDataset(typename FeaturesImage::Pointer image, const std::vector< std::string > &class_filenames,
+	                      const size_t max_samples_per_class = 0, const uint64_t seed = 0);
 
 	/**
 	 * Build a ClassificationDataset from a a list of images (and theirs associated masks).
@@ -56,17 +89,19 @@ public:
 	 *
 	 * @param image The filenames of the images that holds the features.
 	 * @param class_filenames The filenames of the masks.
+	 * @param max_samples_per_class The maximum number of patterns per class (0: no limit).
+	 *        The patterns are uniformly sampled among the pixels of the masks of all the images.
+	 * @param seed The seed used to sample the patterns.
 	 */
-	ClassificationDataset(const std::vector< std::string > &image_filenames, const std::vector< std::string > &class_filenames);
-
-	ClassificationDataset(ClassVector *classes, const int number_of_classes, const int input_size);
+	ClassificationDataset(const std::vector< std::string > &image_filenames, const std::vector< std::string > &class_filenames,
+	                      const size_t max_samples_per_class = 0, const uint64_t seed = 0);
 
 	/**
-	 * Returns a reference on a class.
+	 * Returns a view on a class.
 	 *
 	 * @param c The index of the class.
 	 */
-	const Class& getClass(const int c) const;
+	Class getClass(const int c) const;
 
 	/** The number of classes. */
 	int getNumberOfClasses() const;
@@ -79,18 +114,90 @@ public:
 
 	void checkValid() const;
 
+	/**
+	 * Splits the dataset in two. The new datasets share the storage of this one,
+	 * only the indices of the rows are copied.
+	 */
 	std::pair< boost::shared_ptr< ClassificationDataset<InputValueType> >, boost::shared_ptr< ClassificationDataset<InputValueType> > > split(const float ratio) const;
 
-	void shuffle();
+	/**
+	 * Shuffles the indices of the rows of each class. The classes are shuffled in parallel,
+	 * each one with its own generator, so the result only depends on the seed.
+	 */
+	void shuffle(const uint64_t seed);
+
+	/**
+	 * Computes the scaling parameters of the patterns of the dataset.
+	 * All the rows of the matrices are used, so it must be called before split().
+	 */
+	boost::shared_ptr< FeatureScaler<InputValueType> > computeScaler(const typename FeatureScaler<InputValueType>::Method method) const;
+
+	/**
+	 * Scales the patterns in place. The matrices shared with other datasets
+	 * (see split()) are scaled as well.
+	 */
+	void scale(const FeatureScaler<InputValueType> &scaler);
+
+	/**
+	 * Writes the patterns of the dataset in a binary file, which can be mapped by load().
+	 * The file is written under a temporary name, then renamed.
+	 *
+	 * The file starts with a header (magic, version, size of a value, length of a pattern,
+	 * number of classes, then the number of patterns and of seen pixels of each class),
+	 * followed by one block of patterns per class. Each block is aligned on
+	 * FeatureMatrix::Alignment bytes.
+	 *
+	 * @param filename The file to write.
+	 */
+	void save(const std::string &filename) const;
+
+	/**
+	 * Maps a dataset written by save(). The patterns are not copied.
+	 *
+	 * @param filename The file to read.
+	 */
+	static boost::shared_ptr< ClassificationDataset<InputValueType> > load(const std::string &filename);
 
 private:
-	void init(const int number_of_classes);
+	/** Build an empty ClassificationDataset. */
+	ClassificationDataset(const int number_of_classes, const size_t max_samples_per_class, const uint64_t seed);
+
+	ClassificationDataset(const MatrixVector &matrices, IndexVectorVector &indices, const int number_of_classes, const int input_size);
+
+	/**
+	 * Appends the classes of several datasets to the classes of this one (the features are
+	 * copied, into matrices allocated once). Each dataset is released once copied.
+	 */
+	void append(std::vector< boost::shared_ptr< ClassificationDataset<InputValueType> > > &datasets);
+
+	/**
+	 * Uniformly samples max_samples_per_class patterns per class among the pixels seen by several
+	 * sampled datasets, each one holding a uniform sample of the pixels of its own masks.
+	 */
+	void merge_samples(const std::vector< boost::shared_ptr< ClassificationDataset<InputValueType> > > &datasets);
+
+	void init(const int number_of_classes, const size_t max_samples_per_class, const uint64_t seed);
+
+	static const char     FileMagic[8];
+	static const uint32_t FileVersion = 1;
+
+	/** Rounds an offset in a file up to a multiple of FeatureMatrix::Alignment. */
+	static size_t align_offset(const size_t offset);
+
 	void load_image(const std::string image_filename, const std::vector< std::string > class_filenames);
 	void load_image(typename FeaturesImage::Pointer image, const std::vector< std::string > class_filenames);
+	void extract_samples(typename FeaturesImage::Pointer image, const std::vector< ImageType::Pointer > &class_images);
 
 	int m_InputSize;
 	int m_NumberOfClasses;
-	ClassVector m_Classes;
+	MatrixVector m_Matrices;
+	IndexVectorVector m_Indices;
+
+	size_t m_MaxSamplesPerClass;
+	uint64_t m_Seed;
+
+	/** The number of pixels selected by the masks of each class, before sampling. */
+	std::vector< size_t > m_NumberOfSeenSamples;
 };
 
 #ifndef MANUAL_INSTANTIATION
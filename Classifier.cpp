@@ -1,5 +1,8 @@
 #include "Classifier.h"
 
+#include <boost/filesystem.hpp>
+#include <stdexcept>
+
 /*
 template <typename TInputValueType>
 unsigned int Classifier<TInputValueType>::Classifier(const unsigned int inputSize, const unsigned int numberOfClasses) :
@@ -19,3 +22,74 @@ unsigned int Classifier<TInputValueType>::getNumberOfClasses()
 {
 	return m_NumberOfClasses;
 }
+
+template <typename TInputValueType>
+void Classifier<TInputValueType>::setScaler(boost::shared_ptr< FeatureScaler<InputValueType> > scaler)
+{
+	m_Scaler = scaler;
+}
+
+template <typename TInputValueType>
+boost::shared_ptr< FeatureScaler<TInputValueType> > Classifier<TInputValueType>::getScaler() const
+{
+	return m_Scaler;
+}
+
+template <typename TInputValueType>
+void Classifier<TInputValueType>::saveScaler(const std::string dir) const
+{
+	const boost::filesystem::path path = boost::filesystem::path(dir) / "scaling.dat";
+
+	if(m_Scaler) {
+		m_Scaler->save(path.native());
+	} else if(boost::filesystem::exists(path)) {
+		// A stale file would scale the inputs of this classifier.
+		boost::filesystem::remove(path);
+	}
+}
+
+template <typename TInputValueType>
+void Classifier<TInputValueType>::loadScaler(const std::string dir)
+{
+	const boost::filesystem::path path = boost::filesystem::path(dir) / "scaling.dat";
+
+	m_Scaler.reset();
+
+	if(boost::filesystem::exists(path))
+		m_Scaler = FeatureScaler<InputValueType>::load(path.native());
+}
+
+template <typename TInputValueType>
+void Classifier<TInputValueType>::saveScaler(ModelFile::Writer &file) const
+{
+	if(m_Scaler) {
+		ModelFile::BlockWriter block;
+		m_Scaler->write(block);
+		file.addBlock(ModelFile::SCALER, block);
+	}
+}
+
+template <typename TInputValueType>
+void Classifier<TInputValueType>::loadScaler(const ModelFile &file)
+{
+	m_Scaler.reset();
+
+	if(file.getNumberOfBlocks(ModelFile::SCALER) > 0) {
+		ModelFile::BlockReader block = file.getBlock(ModelFile::SCALER);
+		m_Scaler = FeatureScaler<InputValueType>::read(block);
+	}
+}
+
+template <typename TInputValueType>
+const TInputValueType* Classifier<TInputValueType>::scale(const std::vector< InputValueType > &input, InputValueType *buffer) const
+{
+	if(!m_Scaler)
+		return input.data();
+
+	if(input.size() != m_Scaler->getInputSize())
+		throw std::runtime_error("The pattern does not have the length expected by the scaler.");
+
+	m_Scaler->transform(input.data(), buffer);
+
+	return buffer;
+}
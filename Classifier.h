@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <string>
+#include <boost/shared_ptr.hpp>
+
+#include "FeatureScaler.h"
 
 template <typename TInputValueType>
 class Classifier
@@ -20,8 +23,32 @@ public:
 	unsigned int getInputSize();
 	unsigned int getNumberOfClasses();
 
+	/** The scaling applied to the patterns before classifying them (none if the pointer is empty). */
+	void setScaler(boost::shared_ptr< FeatureScaler<InputValueType> > scaler);
+	boost::shared_ptr< FeatureScaler<InputValueType> > getScaler() const;
+
 protected:
+	/** Saves the scaler (if any) in dir/scaling.dat. */
+	void saveScaler(const std::string dir) const;
+
+	/** Loads dir/scaling.dat, if it exists. */
+	void loadScaler(const std::string dir);
+
+	/** Adds the scaler (if any) to a model file. */
+	void saveScaler(ModelFile::Writer &file) const;
+
+	/** Reads the scaler of a model file, if it has one. */
+	void loadScaler(const ModelFile &file);
+
+	/**
+	 * Returns the pattern to give to the classifier: the input itself if there is no scaler,
+	 * or its scaled version, stored in buffer (which can hold input.size() values, and is
+	 * usually on the stack of the caller, so classifying a pixel does not allocate).
+	 */
+	const InputValueType* scale(const std::vector< InputValueType > &input, InputValueType *buffer) const;
+
 	unsigned int m_InputSize, m_NumberOfClasses;
+	boost::shared_ptr< FeatureScaler<InputValueType> > m_Scaler;
 };
 
 #ifndef MANUAL_INSTANTIATION
@@ -0,0 +1,155 @@
+#include "DataParallelTrainer.h"
+
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * Internal functions of FANN (fann_internal.h, which is not installed), used
+ * by fann_train_epoch_irpropm(). They are exported by the library.
+ */
+extern "C" {
+void fann_compute_MSE(struct fann *ann, fann_type *desired_output);
+void fann_backpropagate_MSE(struct fann *ann);
+void fann_update_slopes_batch(struct fann *ann, struct fann_layer *layer_begin, struct fann_layer *layer_end);
+void fann_update_weights_irpropm(struct fann *ann, unsigned int first_weight, unsigned int past_end);
+void fann_clear_train_arrays(struct fann *ann);
+}
+
+DataParallelTrainer::DataParallelTrainer(struct fann *ann, const int number_of_shards) :
+	m_NeuralNetwork(ann)
+{
+	for(int i = 0; i < std::max(number_of_shards, 1); ++i)
+		m_Replicas.push_back(boost::shared_ptr< struct fann >(fann_copy(ann), fann_destroy));
+}
+
+int DataParallelTrainer::getDefaultNumberOfShards()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+void DataParallelTrainer::synchronize()
+{
+	for(std::vector< boost::shared_ptr< struct fann > >::const_iterator it = m_Replicas.begin(); it != m_Replicas.end(); ++it)
+	{
+		struct fann *replica = it->get();
+
+		std::copy(m_NeuralNetwork->weights, m_NeuralNetwork->weights + m_NeuralNetwork->total_connections, replica->weights);
+
+		if(replica->train_slopes != NULL)
+			std::fill(replica->train_slopes, replica->train_slopes + replica->total_connections, 0);
+
+		fann_reset_MSE(replica);
+	}
+}
+
+void DataParallelTrainer::reduce_MSE()
+{
+	fann_reset_MSE(m_NeuralNetwork);
+
+	for(std::vector< boost::shared_ptr< struct fann > >::const_iterator it = m_Replicas.begin(); it != m_Replicas.end(); ++it)
+	{
+		m_NeuralNetwork->MSE_value    += (*it)->MSE_value;
+		m_NeuralNetwork->num_MSE      += (*it)->num_MSE;
+		m_NeuralNetwork->num_bit_fail += (*it)->num_bit_fail;
+	}
+}
+
+void DataParallelTrainer::train_shard(const int s, struct fann_train_data *data)
+{
+	struct fann *replica = m_Replicas[s].get();
+	const unsigned int number_of_shards = m_Replicas.size(), number_of_rows = data->num_data;
+	const unsigned int begin = (unsigned long long)number_of_rows * s / number_of_shards,
+	                   end   = (unsigned long long)number_of_rows * (s + 1) / number_of_shards;
+
+	for(unsigned int r = begin; r < end; ++r)
+	{
+		fann_run(replica, data->input[r]);
+		fann_compute_MSE(replica, data->output[r]);
+		fann_backpropagate_MSE(replica);
+		fann_update_slopes_batch(replica, replica->first_layer + 1, replica->last_layer - 1);
+	}
+}
+
+void DataParallelTrainer::test_shard(const int s, struct fann_train_data *data)
+{
+	struct fann *replica = m_Replicas[s].get();
+	const unsigned int number_of_shards = m_Replicas.size(), number_of_rows = data->num_data;
+	const unsigned int begin = (unsigned long long)number_of_rows * s / number_of_shards,
+	                   end   = (unsigned long long)number_of_rows * (s + 1) / number_of_shards;
+
+	for(unsigned int r = begin; r < end; ++r)
+		fann_test(replica, data->input[r], data->output[r]);
+}
+
+float DataParallelTrainer::train_epoch(struct fann_train_data *data)
+{
+	const int number_of_shards = m_Replicas.size();
+
+	if(fann_get_training_algorithm(m_NeuralNetwork) != FANN_TRAIN_RPROP || number_of_shards == 1)
+		return fann_train_epoch(m_NeuralNetwork, data);
+
+	if(m_NeuralNetwork->prev_train_slopes == NULL)
+		fann_clear_train_arrays(m_NeuralNetwork);
+
+	synchronize();
+
+	for(int s = 0; s < number_of_shards; ++s)
+	{
+		#pragma omp task firstprivate(s)
+		train_shard(s, data);
+	}
+
+	#pragma omp taskwait
+
+	// Reduction in the order of the shards.
+	fann_type *slopes = m_NeuralNetwork->train_slopes;
+	const unsigned int total_connections = m_NeuralNetwork->total_connections;
+
+	std::fill(slopes, slopes + total_connections, 0);
+
+	for(int s = 0; s < number_of_shards; ++s)
+	{
+		const fann_type *replica_slopes = m_Replicas[s]->train_slopes;
+
+		if(replica_slopes == NULL) // Empty shard
+			continue;
+
+		for(unsigned int w = 0; w < total_connections; ++w)
+			slopes[w] += replica_slopes[w];
+	}
+
+	reduce_MSE();
+
+	fann_update_weights_irpropm(m_NeuralNetwork, 0, total_connections);
+
+	return fann_get_MSE(m_NeuralNetwork);
+}
+
+float DataParallelTrainer::test_data(struct fann_train_data *data)
+{
+	const int number_of_shards = m_Replicas.size();
+
+	if(number_of_shards == 1)
+		return fann_test_data(m_NeuralNetwork, data);
+
+	synchronize();
+
+	for(int s = 0; s < number_of_shards; ++s)
+	{
+		#pragma omp task firstprivate(s)
+		test_shard(s, data);
+	}
+
+	#pragma omp taskwait
+
+	reduce_MSE();
+
+	return fann_get_MSE(m_NeuralNetwork);
+}
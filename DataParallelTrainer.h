@@ -0,0 +1,64 @@
+#ifndef DATAPARALLELTRAINER_H
+#define DATAPARALLELTRAINER_H
+
+#include "NeuralNetworkTrainer.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <vector>
+
+/**
+ * \class DataParallelTrainer
+ *
+ * \brief Trains a single neural network on several threads (iRPROP-, batch).
+ *
+ * The training-set is split in as many contiguous shards as there are replicas of the
+ * network. During an epoch, each replica receives the current weights and accumulates
+ * the slopes (and the MSE) of its shard. The slopes are then summed in the order of the
+ * shards, and the weights of the network are updated once, exactly like
+ * fann_train_epoch() would do (up to the order of the floating-point additions).
+ *
+ * For any other training algorithm, fann_train_epoch() is used.
+ *
+ * The shards are processed as OpenMP tasks, and the trainer is meant to be used from a
+ * task (or a parallel region): several trainers running concurrently then share the
+ * threads, since a thread waiting for the shards of its network executes the pending
+ * shards of the others. Outside of a parallel region, the shards are processed one after
+ * the other.
+ */
+class DataParallelTrainer : public NeuralNetworkTrainer, private boost::noncopyable
+{
+public:
+	/**
+	 * @param ann The network to train (not owned).
+	 * @param number_of_shards The number of shards (and threads) to use.
+	 */
+	DataParallelTrainer(struct fann *ann, const int number_of_shards);
+
+	/** Performs one training epoch, and returns the MSE (see fann_train_epoch()). */
+	float train_epoch(struct fann_train_data *data);
+
+	/** Computes the MSE of the network on a dataset (see fann_test_data()). */
+	float test_data(struct fann_train_data *data);
+
+	/** The default number of shards: the number of threads available. */
+	static int getDefaultNumberOfShards();
+
+private:
+	/** Gives the current weights of the network to the replicas and resets their errors. */
+	void synchronize();
+
+	/** Accumulates the slopes and the MSE of a shard in its replica. */
+	void train_shard(const int s, struct fann_train_data *data);
+
+	/** Accumulates the MSE of a shard in its replica. */
+	void test_shard(const int s, struct fann_train_data *data);
+
+	/** Sums the MSE of the replicas in the network. */
+	void reduce_MSE();
+
+	struct fann *m_NeuralNetwork;
+	std::vector< boost::shared_ptr< struct fann > > m_Replicas;
+};
+
+#endif /* DATAPARALLELTRAINER_H */
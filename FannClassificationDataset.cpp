@@ -1,8 +1,11 @@
 #include "FannClassificationDataset.h"
 
 #include <cmath>
+#include <cstring> // memset()
 #include <log4cxx/logger.h>
 
+#include "RandomGenerator.h"
+
 
 
 float round(float r) {
@@ -11,17 +14,17 @@ float round(float r) {
 
 
 
-FannClassificationDataset::FannClassificationDataset(ClassificationDataset<fann_type> &classificationDataset) :
+FannClassificationDataset::FannClassificationDataset(boost::shared_ptr< ClassificationDataset<fann_type> > classificationDataset) :
 	m_Container()
 {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
-	const int numberOfClasses = classificationDataset.getNumberOfClasses();
+	const int numberOfClasses = classificationDataset->getNumberOfClasses();
 
 	if(0 == numberOfClasses)
 		throw FannClassificationDatasetException("Cannot build a FannClassificationDataset from an empty ClassificationDataset.");
 
-	m_InputSize = classificationDataset.getInputSize();
+	m_InputSize = classificationDataset->getInputSize();
 
 	if(0 == m_InputSize)
 		throw FannClassificationDatasetException("The ClassificationDataset used to construct the FannClassificationDataset contains empty features.");
@@ -34,7 +37,7 @@ FannClassificationDataset::FannClassificationDataset(ClassificationDataset<fann_
 	{
 		for(int i = 0; i < numberOfClasses; ++i)
 		{
-			const ClassificationDataset<fann_type>::Class &c = classificationDataset.getClass(i);
+			const ClassificationDataset<fann_type>::Class c = classificationDataset->getClass(i);
 
 			if(c.empty()) {
 				std::stringstream err;
@@ -48,51 +51,36 @@ FannClassificationDataset::FannClassificationDataset(ClassificationDataset<fann_
 		}
 	}
 
-	// Creating one data set that will be used to initialized the others
-	FannDataset *training_data = fann_create_train(total_number_of_elements, m_InputSize, 1);
-	fann_type **training_data_input_it = training_data->input;
-	fann_type **training_data_output_it = training_data->output;
+	// The input rows point to the patterns of the classes, one class after the other.
+	// FANN never writes to the inputs, so the const_cast is safe.
+	boost::shared_ptr< RowVector > input(new RowVector());
+	input->reserve(total_number_of_elements);
 
 	for(int i = 0; i < numberOfClasses; ++i)
 	{
-		const ClassificationDataset<fann_type>::Class &current_class = classificationDataset.getClass(i);
-
-		ClassificationDataset<fann_type>::Class::const_iterator current_raw_class_it = current_class.begin(), current_raw_class_end = current_class.end();
+		const ClassificationDataset<fann_type>::Class current_class = classificationDataset->getClass(i);
 
-		while(current_raw_class_it != current_raw_class_end)
-		{
-			// Copying the features
-			std::copy(
-					current_raw_class_it->begin(),
-					current_raw_class_it->end(), 
-					*training_data_input_it
-					);
-
-			// Don't care about the output right now
-			**training_data_output_it = 0;
-
-			++current_raw_class_it;
-			++training_data_input_it;
-			++training_data_output_it;
-		}
+		for(size_t j = 0; j < current_class.size(); ++j)
+			input->push_back(const_cast< fann_type* >(current_class[j]));
 	}
 
-	// Storing the first one
-	m_Container.push_back( boost::shared_ptr< FannDataset >( training_data, fann_destroy_train ) );
+	m_InputStorage = input;
+	m_Input = &((*input)[0]);
+	m_NumberOfRows = total_number_of_elements;
 
-	// Storing copies of the first one
-	for(int i = 1; i < numberOfClassifiers; ++i) {
-		m_Container.push_back( boost::shared_ptr< FannDataset >( fann_duplicate_train_data(training_data), fann_destroy_train ) );
-	}
+	// Each set only owns its outputs
+	for(int i = 0; i < numberOfClassifiers; ++i)
+		m_Container.push_back(create_set(m_Input, m_NumberOfRows, m_InputSize, classificationDataset));
 
 	// Set the desired output of a class to 1 in the dataset representing this class
 	int class_start = 0, current_class_size;
 	for(int i = 0; i < numberOfClassifiers; ++i) {
-		current_class_size = classificationDataset.getClass(i).size();
+		current_class_size = classificationDataset->getClass(i).size();
 
-		fann_type *output_start = *(m_Container[i]->output) + class_start;
+		fann_type **output_start = m_Container[i]->output + class_start;
 
-		std::fill(output_start, output_start + current_class_size, 1);
+		for(int j = 0; j < current_class_size; ++j)
+			*(output_start[j]) = 1;
 
 		class_start += current_class_size;
 	}
@@ -100,8 +88,9 @@ FannClassificationDataset::FannClassificationDataset(ClassificationDataset<fann_
 
 
 
-FannClassificationDataset::FannClassificationDataset(Container &sets, const int featuresLength) :
-	m_Container(sets), m_InputSize(featuresLength)
+FannClassificationDataset::FannClassificationDataset(Container &sets, boost::shared_ptr< RowVector > input_storage, fann_type **input,
+                                                     const unsigned int number_of_rows, const int featuresLength) :
+	m_InputSize(featuresLength), m_Container(sets), m_InputStorage(input_storage), m_Input(input), m_NumberOfRows(number_of_rows)
 {}
 
 
@@ -110,37 +99,63 @@ FannClassificationDataset::~FannClassificationDataset() {}
 
 
 
+boost::shared_ptr< FannClassificationDataset::FannDataset > FannClassificationDataset::create_set(
+	fann_type **input, const unsigned int number_of_rows, const int input_size,
+	boost::shared_ptr< void > owner, fann_type **output)
+{
+	boost::shared_ptr< Set > set(new Set());
+
+	set->owner = owner;
+
+	if(output == NULL) {
+		set->output.resize(number_of_rows);
+		set->output_values.assign(number_of_rows, 0);
+		for(unsigned int r = 0; r < number_of_rows; ++r)
+			set->output[r] = &(set->output_values[r]);
+
+		output = number_of_rows > 0 ? &(set->output[0]) : NULL;
+	}
+
+	memset(&(set->data), 0, sizeof(FannDataset));
+	set->data.errno_f    = FANN_E_NO_ERROR;
+	set->data.error_log  = fann_default_error_log;
+	set->data.num_data   = number_of_rows;
+	set->data.num_input  = input_size;
+	set->data.num_output = 1;
+	set->data.input      = input;
+	set->data.output     = output;
+
+	// The returned pointer owns the whole Set.
+	return boost::shared_ptr< FannDataset >(set, &(set->data));
+}
+
+
+
 std::pair< boost::shared_ptr< FannClassificationDataset >, boost::shared_ptr< FannClassificationDataset > > 
 FannClassificationDataset::split(const float ratio) const
 {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
-	int numberOfDatasets = getNumberOfDatasets();
-
-	Container first_sets;  first_sets.reserve(getNumberOfDatasets());
-	Container second_sets; second_sets.reserve(getNumberOfDatasets());
+	const unsigned int cut             = round( m_NumberOfRows * ratio ),
+	                   second_set_size = m_NumberOfRows - cut;
 
-	for(FannDatasetVector::const_iterator it = m_Container.begin(); it < m_Container.end(); ++it) {
-		const unsigned int first_set_size  = fann_length_train_data(it->get()),
-		                   cut             = round( first_set_size * ratio ),
-		                   second_set_size = first_set_size - cut;
+	if((0 == cut) || (0 == second_set_size))
+		throw FannClassificationDatasetException("Cannot split this FannClassificationDataset. The ratio will ends-up generating an empty set.");
 
-		if((0 == cut) || (0 == second_set_size))
-			throw FannClassificationDatasetException("Cannot split this FannClassificationDataset. The ratio will ends-up generating an empty set.");
+	LOG4CXX_INFO(logger, "\tFirst set will be " << cut << " elements long, second set will be " << second_set_size << " elements long.");
 
-		LOG4CXX_INFO(logger, "\tFirst set will be " << cut << " elements long, second set will be " << second_set_size << " elements long.");
-
-		FannDataset *first_subset  = fann_subset_train_data(it->get(), 0, cut),
-		            *second_subset = fann_subset_train_data(it->get(), cut, second_set_size);
-		// TODO Check for null
+	// The new sets are views on the rows [0, cut) and [cut, m_NumberOfRows) of the current ones.
+	Container first_sets;  first_sets.reserve(getNumberOfDatasets());
+	Container second_sets; second_sets.reserve(getNumberOfDatasets());
 
-		first_sets.push_back(boost::shared_ptr< FannDataset >(first_subset, fann_destroy_train));
-		second_sets.push_back(boost::shared_ptr< FannDataset >(second_subset, fann_destroy_train));
+	for(Container::const_iterator it = m_Container.begin(); it < m_Container.end(); ++it) {
+		first_sets.push_back(create_set(m_Input, cut, m_InputSize, *it, (*it)->output));
+		second_sets.push_back(create_set(m_Input + cut, second_set_size, m_InputSize, *it, (*it)->output + cut));
 	}
 
 	return std::make_pair(
-		new FannClassificationDataset(first_sets, m_InputSize),
-		new FannClassificationDataset(second_sets, m_InputSize)
+		boost::shared_ptr< FannClassificationDataset >(new FannClassificationDataset(first_sets, m_InputStorage, m_Input, cut, m_InputSize)),
+		boost::shared_ptr< FannClassificationDataset >(new FannClassificationDataset(second_sets, m_InputStorage, m_Input + cut, second_set_size, m_InputSize))
 		);
 }
 
@@ -160,9 +175,31 @@ const int FannClassificationDataset::getInputSize() const
 
 
 
-void FannClassificationDataset::shuffle() {
-	for(std::vector< boost::shared_ptr< FannDataset > >::const_iterator it = m_Container.begin(); it != m_Container.end(); ++it)
-		fann_shuffle_train_data(it->get());
+void FannClassificationDataset::shuffle(const uint64_t seed) {
+	if(m_NumberOfRows < 2)
+		return;
+
+	// Fisher-Yates: the row j is swapped with the row swaps[j - 1].
+	std::vector< unsigned int > swaps(m_NumberOfRows - 1);
+
+	RandomGenerator generator(seed);
+	for(unsigned int j = m_NumberOfRows - 1; j > 0; --j)
+		swaps[j - 1] = generator.uniform(j + 1);
+
+	// The inputs, then the outputs of each set.
+	std::vector< fann_type** > arrays(1, m_Input);
+	for(Container::const_iterator it = m_Container.begin(); it != m_Container.end(); ++it)
+		arrays.push_back((*it)->output);
+
+	const int number_of_arrays = arrays.size();
+
+	#pragma omp parallel for
+	for(int a = 0; a < number_of_arrays; ++a)
+	{
+		fann_type **rows = arrays[a];
+		for(unsigned int j = m_NumberOfRows - 1; j > 0; --j)
+			std::swap(rows[j], rows[swaps[j - 1]]);
+	}
 }
 
 
@@ -15,6 +15,18 @@ public:
 	FannClassificationDatasetException ( const std::string &err ) : std::runtime_error(err) {}
 };
 
+/**
+ * \class FannClassificationDataset
+ *
+ * \brief The one-vs-all training sets of the neural networks (one per classifier).
+ *
+ * The sets share a single array of input rows, which points directly to the patterns
+ * of the ClassificationDataset (they are never copied). Each set only owns its
+ * desired outputs. The inputs must not be modified (e.g. by fann_scale_train()).
+ *
+ * A FannClassificationDataset produced by split() is a view on a range of the rows
+ * of its parent: nothing is copied.
+ */
 class FannClassificationDataset
 {
 public:
@@ -23,22 +35,63 @@ public:
 
 private:
 	typedef std::vector< boost::shared_ptr< FannDataset > > Container;
+	typedef std::vector< fann_type* > RowVector;
+
+	/**
+	 * The storage of a FannDataset. The rows of data.input are shared by all the sets,
+	 * the rows of data.output are specific to the set (output is empty for a view).
+	 */
+	struct Set
+	{
+		FannDataset data;
+		RowVector output;
+		std::vector< fann_type > output_values;
+
+		/** Keeps alive the rows referenced by the set. */
+		boost::shared_ptr< void > owner;
+	};
 
 public:
-	FannClassificationDataset(ClassificationDataset<fann_type> &classificationDataset);
-	FannClassificationDataset(Container &sets, const int featuresLength);
+	FannClassificationDataset(boost::shared_ptr< ClassificationDataset<fann_type> > classificationDataset);
 	~FannClassificationDataset();
 
+	/**
+	 * Splits the rows in two ranges. The new datasets are views on this one:
+	 * shuffling them reorders the rows of this one.
+	 */
 	std::pair< boost::shared_ptr< FannClassificationDataset >, boost::shared_ptr< FannClassificationDataset > > split(const float ratio) const;
 
 	const int getNumberOfDatasets() const;
 	const int getInputSize() const;
-	void shuffle();
+
+	/**
+	 * Shuffles the rows. The same permutation is applied to every set:
+	 * it is drawn once, then applied to the arrays of rows in parallel.
+	 */
+	void shuffle(const uint64_t seed);
+
 	FannDataset* getSet(const int i) const;
 
 private:
+	FannClassificationDataset(Container &sets, boost::shared_ptr< RowVector > input_storage, fann_type **input,
+	                          const unsigned int number_of_rows, const int featuresLength);
+
+	/**
+	 * Builds a set on top of the shared input rows.
+	 *
+	 * @param owner Keeps alive the rows referenced by the set.
+	 * @param output The output rows of the set (a range of the rows of another set). If NULL, the outputs are allocated and set to 0.
+	 */
+	static boost::shared_ptr< FannDataset > create_set(fann_type **input, const unsigned int number_of_rows, const int input_size,
+	                                                    boost::shared_ptr< void > owner, fann_type **output = NULL);
+
 	int m_InputSize;
 	Container m_Container;
+
+	/** The input rows shared by the sets: m_Input is a range of m_InputStorage. */
+	boost::shared_ptr< RowVector > m_InputStorage;
+	fann_type **m_Input;
+	unsigned int m_NumberOfRows;
 };
 
 #endif /* FANNCLASSIFICATIONDATASET_H */
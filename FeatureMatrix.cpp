@@ -0,0 +1,103 @@
+#include "FeatureMatrix.h"
+
+#include <cstdlib> // posix_memalign(), free()
+#include <cstring> // memcpy()
+#include <new>     // std::bad_alloc
+
+template <typename TValueType>
+FeatureMatrix<TValueType>::FeatureMatrix(const size_t number_of_columns) :
+	m_NumberOfRows(0),
+	m_NumberOfColumns(number_of_columns),
+	m_Capacity(0),
+	m_Data(NULL)
+{}
+
+template <typename TValueType>
+FeatureMatrix<TValueType>::FeatureMatrix(const size_t number_of_columns, const size_t number_of_rows, ValueType *data, boost::shared_ptr< void > owner) :
+	m_NumberOfRows(number_of_rows),
+	m_NumberOfColumns(number_of_columns),
+	m_Capacity(number_of_rows),
+	m_Data(data),
+	m_Owner(owner)
+{}
+
+template <typename TValueType>
+FeatureMatrix<TValueType>::~FeatureMatrix()
+{
+	if(!m_Owner)
+		free(m_Data);
+}
+
+template <typename TValueType>
+size_t FeatureMatrix<TValueType>::getNumberOfRows() const
+{
+	return m_NumberOfRows;
+}
+
+template <typename TValueType>
+size_t FeatureMatrix<TValueType>::getNumberOfColumns() const
+{
+	return m_NumberOfColumns;
+}
+
+template <typename TValueType>
+void FeatureMatrix<TValueType>::reserve(const size_t number_of_rows)
+{
+	if(number_of_rows <= m_Capacity)
+		return;
+
+	void *block = NULL;
+	const size_t size = number_of_rows * m_NumberOfColumns * sizeof(ValueType);
+
+	if(posix_memalign(&block, Alignment, size > 0 ? size : Alignment) != 0)
+		throw std::bad_alloc();
+
+	if(m_Data != NULL) {
+		memcpy(block, m_Data, m_NumberOfRows * m_NumberOfColumns * sizeof(ValueType));
+		if(!m_Owner)
+			free(m_Data);
+	}
+
+	m_Owner.reset();
+
+	m_Data = static_cast< ValueType* >(block);
+	m_Capacity = number_of_rows;
+}
+
+template <typename TValueType>
+typename FeatureMatrix<TValueType>::ValueType* FeatureMatrix<TValueType>::appendRows(const size_t number_of_rows)
+{
+	const size_t required = m_NumberOfRows + number_of_rows;
+
+	if(required > m_Capacity)
+		reserve(required > 2 * m_Capacity ? required : 2 * m_Capacity);
+
+	ValueType *first = m_Data + m_NumberOfRows * m_NumberOfColumns;
+	m_NumberOfRows = required;
+
+	return first;
+}
+
+template <typename TValueType>
+typename FeatureMatrix<TValueType>::ValueType* FeatureMatrix<TValueType>::getRow(const size_t r)
+{
+	return m_Data + r * m_NumberOfColumns;
+}
+
+template <typename TValueType>
+const typename FeatureMatrix<TValueType>::ValueType* FeatureMatrix<TValueType>::getRow(const size_t r) const
+{
+	return m_Data + r * m_NumberOfColumns;
+}
+
+template <typename TValueType>
+typename FeatureMatrix<TValueType>::ValueType* FeatureMatrix<TValueType>::data()
+{
+	return m_Data;
+}
+
+template <typename TValueType>
+const typename FeatureMatrix<TValueType>::ValueType* FeatureMatrix<TValueType>::data() const
+{
+	return m_Data;
+}
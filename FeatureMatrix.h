@@ -0,0 +1,81 @@
+#ifndef FEATUREMATRIX_H
+#define FEATUREMATRIX_H
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstddef>
+#include <stdexcept>
+
+/**
+ * \class FeatureMatrix
+ *
+ * \brief A row-major matrix of features stored in a single contiguous block.
+ *
+ * Each row is a pattern. The block is aligned on FeatureMatrix::Alignment bytes
+ * so that it can be processed with SIMD instructions.
+ *
+ * The template parameter correspond to the data type of the patterns (float, double).
+ */
+template <typename TValueType>
+class FeatureMatrix : private boost::noncopyable
+{
+public:
+	typedef TValueType ValueType;
+
+	static const size_t Alignment = 64;
+
+	/**
+	 * Build an empty matrix.
+	 *
+	 * @param number_of_columns The length of a pattern.
+	 */
+	FeatureMatrix(const size_t number_of_columns);
+
+	/**
+	 * Build a matrix on top of an external block (e.g. a mapped file).
+	 * The block is not copied until rows are appended.
+	 *
+	 * @param number_of_columns The length of a pattern.
+	 * @param number_of_rows The number of patterns in the block.
+	 * @param data The block, aligned on FeatureMatrix::Alignment bytes.
+	 * @param owner Keeps the block alive as long as the matrix uses it.
+	 */
+	FeatureMatrix(const size_t number_of_columns, const size_t number_of_rows, ValueType *data, boost::shared_ptr< void > owner);
+
+	~FeatureMatrix();
+
+	size_t getNumberOfRows() const;
+	size_t getNumberOfColumns() const;
+
+	/** Makes sure the matrix can hold this number of rows without being reallocated. */
+	void reserve(const size_t number_of_rows);
+
+	/**
+	 * Appends uninitialized rows to the matrix.
+	 * Pointers to the rows are invalidated if the matrix has to grow.
+	 *
+	 * @return A pointer to the first appended row.
+	 */
+	ValueType* appendRows(const size_t number_of_rows);
+
+	ValueType* getRow(const size_t r);
+	const ValueType* getRow(const size_t r) const;
+
+	ValueType* data();
+	const ValueType* data() const;
+
+private:
+	size_t m_NumberOfRows;
+	size_t m_NumberOfColumns;
+	size_t m_Capacity;
+	ValueType *m_Data;
+
+	/** The owner of m_Data when the block is external. */
+	boost::shared_ptr< void > m_Owner;
+};
+
+#ifndef MANUAL_INSTANTIATION
+#include "FeatureMatrix.cpp"
+#endif
+
+#endif /* FEATUREMATRIX_H */
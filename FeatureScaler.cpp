@@ -0,0 +1,223 @@
+#include "FeatureScaler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+
+template <typename TValueType>
+FeatureScaler<TValueType>::FeatureScaler(const Method method, const std::vector< ValueType > &offset, const std::vector< ValueType > &scale) :
+	m_Method(method),
+	m_Offset(offset),
+	m_Scale(scale)
+{}
+
+template <typename TValueType>
+boost::shared_ptr< FeatureScaler<TValueType> > FeatureScaler<TValueType>::fit(const std::vector< const Matrix* > &matrices, const Method method)
+{
+	const size_t chunk_size = 4096;
+
+	if(matrices.empty())
+		throw FeatureScalerException("Cannot compute the scaling parameters without any pattern.");
+
+	const size_t input_size = matrices.front()->getNumberOfColumns();
+
+	// The chunks of rows: (matrix, first row)
+	std::vector< std::pair< size_t, size_t > > chunks;
+	for(size_t m = 0; m < matrices.size(); ++m) {
+		if(matrices[m]->getNumberOfColumns() != input_size)
+			throw FeatureScalerException("The patterns do not have the same length.");
+
+		for(size_t r = 0; r < matrices[m]->getNumberOfRows(); r += chunk_size)
+			chunks.push_back(std::make_pair(m, r));
+	}
+
+	const long number_of_chunks = chunks.size();
+
+	if(0 == number_of_chunks)
+		throw FeatureScalerException("Cannot compute the scaling parameters without any pattern.");
+
+	// Statistics of each chunk (Welford's algorithm), stored chunk after chunk.
+	std::vector< size_t > counts(number_of_chunks, 0);
+	std::vector< double > means(number_of_chunks * input_size, 0), m2s(number_of_chunks * input_size, 0),
+	                      mins(number_of_chunks * input_size,  std::numeric_limits< double >::max()),
+	                      maxs(number_of_chunks * input_size, -std::numeric_limits< double >::max());
+
+	#pragma omp parallel for schedule(dynamic)
+	for(long k = 0; k < number_of_chunks; ++k)
+	{
+		const Matrix &matrix = *(matrices[chunks[k].first]);
+		const size_t begin = chunks[k].second,
+		             end   = std::min(begin + chunk_size, matrix.getNumberOfRows());
+
+		double *mean = &(means[k * input_size]), *m2 = &(m2s[k * input_size]),
+		       *min  = &(mins[k * input_size]),  *max = &(maxs[k * input_size]);
+
+		for(size_t r = begin; r < end; ++r)
+		{
+			const ValueType *row = matrix.getRow(r);
+			const double n = r - begin + 1;
+
+			for(size_t c = 0; c < input_size; ++c)
+			{
+				const double x = row[c], delta = x - mean[c];
+				mean[c] += delta / n;
+				m2[c] += delta * (x - mean[c]);
+				min[c] = std::min(min[c], x);
+				max[c] = std::max(max[c], x);
+			}
+		}
+
+		counts[k] = end - begin;
+	}
+
+	// Merging the statistics of the chunks (Chan et al.)
+	std::vector< double > mean(input_size, 0), m2(input_size, 0),
+	                      min(input_size, std::numeric_limits< double >::max()),
+	                      max(input_size, -std::numeric_limits< double >::max());
+	double count = 0;
+
+	for(long k = 0; k < number_of_chunks; ++k)
+	{
+		const double n = counts[k], total = count + n;
+
+		for(size_t c = 0; c < input_size; ++c)
+		{
+			const double delta = means[k * input_size + c] - mean[c];
+			mean[c] += delta * n / total;
+			m2[c] += m2s[k * input_size + c] + delta * delta * count * n / total;
+			min[c] = std::min(min[c], mins[k * input_size + c]);
+			max[c] = std::max(max[c], maxs[k * input_size + c]);
+		}
+
+		count = total;
+	}
+
+	// A constant component is only shifted.
+	std::vector< ValueType > offset(input_size), scale(input_size);
+	for(size_t c = 0; c < input_size; ++c)
+	{
+		if(method == STANDARD) {
+			const double deviation = std::sqrt(m2[c] / count);
+			offset[c] = mean[c];
+			scale[c] = deviation > 0 ? 1.0 / deviation : 1.0;
+		} else {
+			offset[c] = min[c];
+			scale[c] = max[c] > min[c] ? 1.0 / (max[c] - min[c]) : 1.0;
+		}
+	}
+
+	return boost::shared_ptr< FeatureScaler<TValueType> >(new FeatureScaler(method, offset, scale));
+}
+
+template <typename TValueType>
+boost::shared_ptr< FeatureScaler<TValueType> > FeatureScaler<TValueType>::load(const std::string &filename)
+{
+	std::ifstream file(filename.c_str());
+	if(!file)
+		throw FeatureScalerException("Cannot open the scaling parameters file " + filename);
+
+	std::string method_name;
+	size_t input_size;
+
+	if(!(file >> method_name >> input_size) || (method_name != "standard" && method_name != "minmax"))
+		throw FeatureScalerException("Invalid scaling parameters file " + filename);
+
+	std::vector< ValueType > offset(input_size), scale(input_size);
+	for(size_t c = 0; c < input_size; ++c)
+	{
+		if(!(file >> offset[c] >> scale[c]))
+			throw FeatureScalerException("Invalid scaling parameters file " + filename);
+	}
+
+	return boost::shared_ptr< FeatureScaler<TValueType> >(new FeatureScaler(method_name == "standard" ? STANDARD : MINMAX, offset, scale));
+}
+
+template <typename TValueType>
+void FeatureScaler<TValueType>::save(const std::string &filename) const
+{
+	std::ofstream file;
+	file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	try {
+		file.open(filename.c_str(), std::ios::out | std::ios::trunc);
+
+		file << (m_Method == STANDARD ? "standard" : "minmax") << std::endl;
+		file << m_Offset.size() << std::endl;
+
+		file << std::setprecision(std::numeric_limits< ValueType >::digits10 + 2);
+		for(size_t c = 0; c < m_Offset.size(); ++c)
+			file << m_Offset[c] << "\t" << m_Scale[c] << std::endl;
+
+		file.close();
+	} catch(std::ofstream::failure &e) {
+		throw FeatureScalerException("Cannot save the scaling parameters in " + filename + " (" + e.what() + ")");
+	}
+}
+
+template <typename TValueType>
+boost::shared_ptr< FeatureScaler<TValueType> > FeatureScaler<TValueType>::read(ModelFile::BlockReader &block)
+{
+	const uint32_t method = block.read< uint32_t >(), value_size = block.read< uint32_t >();
+	const uint64_t input_size = block.read< uint64_t >();
+
+	if((method != STANDARD && method != MINMAX) || value_size != sizeof(ValueType))
+		throw FeatureScalerException("Unsupported scaling parameters in the model file.");
+
+	const ValueType *offset = block.read< ValueType >(input_size), *scale = block.read< ValueType >(input_size);
+
+	return boost::shared_ptr< FeatureScaler<TValueType> >(new FeatureScaler(static_cast< Method >(method),
+		std::vector< ValueType >(offset, offset + input_size), std::vector< ValueType >(scale, scale + input_size)));
+}
+
+template <typename TValueType>
+void FeatureScaler<TValueType>::write(ModelFile::BlockWriter &block) const
+{
+	block.write< uint32_t >(m_Method);
+	block.write< uint32_t >(sizeof(ValueType));
+	block.write< uint64_t >(m_Offset.size());
+	block.write(&(m_Offset[0]), m_Offset.size());
+	block.write(&(m_Scale[0]), m_Scale.size());
+}
+
+template <typename TValueType>
+typename FeatureScaler<TValueType>::Method FeatureScaler<TValueType>::getMethod() const
+{
+	return m_Method;
+}
+
+template <typename TValueType>
+size_t FeatureScaler<TValueType>::getInputSize() const
+{
+	return m_Offset.size();
+}
+
+template <typename TValueType>
+void FeatureScaler<TValueType>::transform(ValueType *pattern) const
+{
+	transform(pattern, pattern);
+}
+
+template <typename TValueType>
+void FeatureScaler<TValueType>::transform(const ValueType *pattern, ValueType *output) const
+{
+	const size_t input_size = m_Offset.size();
+	const ValueType *offset = &(m_Offset[0]), *scale = &(m_Scale[0]);
+
+	for(size_t c = 0; c < input_size; ++c)
+		output[c] = (pattern[c] - offset[c]) * scale[c];
+}
+
+template <typename TValueType>
+void FeatureScaler<TValueType>::transform(Matrix &matrix) const
+{
+	if(matrix.getNumberOfColumns() != m_Offset.size())
+		throw FeatureScalerException("The patterns do not have the expected length.");
+
+	const long number_of_rows = matrix.getNumberOfRows();
+
+	#pragma omp parallel for
+	for(long r = 0; r < number_of_rows; ++r)
+		transform(matrix.getRow(r));
+}
@@ -0,0 +1,86 @@
+#ifndef FEATURESCALER_H
+#define FEATURESCALER_H
+
+#include "FeatureMatrix.h"
+#include "ModelFile.h"
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+class FeatureScalerException : public std::runtime_error
+{
+public:
+	FeatureScalerException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+/**
+ * \class FeatureScaler
+ *
+ * \brief Scales each component of the patterns: x' = (x - offset) * scale.
+ *
+ * STANDARD scaling centers the components and divides them by their standard deviation,
+ * MINMAX scaling maps them to [0, 1]. The parameters are computed on the training-set
+ * and stored with the classifier, so the same scaling is applied when classifying.
+ *
+ * The template parameter correspond to the data type of the patterns (float, double).
+ */
+template <typename TValueType>
+class FeatureScaler
+{
+public:
+	typedef TValueType ValueType;
+	typedef FeatureMatrix< ValueType > Matrix;
+
+	enum Method {
+		STANDARD = 0,
+		MINMAX
+	};
+
+	/**
+	 * Computes the scaling parameters from all the rows of some matrices, in a single
+	 * parallel pass. The matrices are processed by chunks of rows whose statistics are
+	 * merged in order, so the result does not depend on the number of threads.
+	 */
+	static boost::shared_ptr< FeatureScaler<ValueType> > fit(const std::vector< const Matrix* > &matrices, const Method method);
+
+	/**
+	 * Loads the parameters written by save().
+	 *
+	 * @param filename The file to read.
+	 */
+	static boost::shared_ptr< FeatureScaler<ValueType> > load(const std::string &filename);
+
+	void save(const std::string &filename) const;
+
+	/** Reads the parameters written by write() in a block of a model file. */
+	static boost::shared_ptr< FeatureScaler<ValueType> > read(ModelFile::BlockReader &block);
+
+	void write(ModelFile::BlockWriter &block) const;
+
+	Method getMethod() const;
+	size_t getInputSize() const;
+
+	/** Scales a pattern in place. */
+	void transform(ValueType *pattern) const;
+
+	/** Scales a pattern. */
+	void transform(const ValueType *pattern, ValueType *output) const;
+
+	/** Scales all the rows of a matrix in place (in parallel). */
+	void transform(Matrix &matrix) const;
+
+private:
+	FeatureScaler(const Method method, const std::vector< ValueType > &offset, const std::vector< ValueType > &scale);
+
+	Method m_Method;
+	std::vector< ValueType > m_Offset;
+	std::vector< ValueType > m_Scale;
+};
+
+#ifndef MANUAL_INSTANTIATION
+#include "FeatureScaler.cpp"
+#endif
+
+#endif /* FEATURESCALER_H */
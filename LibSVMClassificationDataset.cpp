@@ -1,9 +1,50 @@
 #include "LibSVMClassificationDataset.h"
 //#include <fstream> // XXX
 #include <iostream>
+#include <algorithm>
 
-LibSVMClassificationDataset::LibSVMClassificationDataset(ClassificationDataset<double> &classificationDataset)
+#ifdef _DENSE_REP
+
+LibSVMClassificationDataset::LibSVMClassificationDataset(boost::shared_ptr< ClassificationDataset<double> > classificationDataset) :
+	m_ClassificationDataset(classificationDataset)
+{
+	m_InputSize = classificationDataset->getInputSize();
+	const int numberOfInputs = classificationDataset->getNumberOfInputs();
+
+	prob.l = numberOfInputs;
+	prob.x = NULL;
+	prob.y = NULL;
+
+	try {
+		prob.x = new svm_node[numberOfInputs];
+		prob.y = new double[numberOfInputs];
+	} catch (std::bad_alloc& ba) {
+		delete[] prob.x;
+
+		throw LibSVMClassificationDatasetException("Cannot allocate memory.");
+	}
+
+	// LIBSVM never writes to the values, so the const_cast is safe.
+	int globalInputId = 0;
+	for(int i = 0; i < classificationDataset->getNumberOfClasses(); ++i)
+	{
+		const ClassificationDataset<double>::Class c = classificationDataset->getClass(i);
+
+		for(int inputId = 0; inputId < c.size(); ++inputId, ++globalInputId)
+		{
+			prob.y[globalInputId] = i+1; // The class
+			prob.x[globalInputId].dim = m_InputSize;
+			prob.x[globalInputId].values = const_cast< double* >(c[inputId]);
+		}
+	}
+}
+
+#else
+
+LibSVMClassificationDataset::LibSVMClassificationDataset(boost::shared_ptr< ClassificationDataset<double> > dataset)
 {
+	ClassificationDataset<double> &classificationDataset = *dataset;
+
 	m_InputSize = classificationDataset.getInputSize();
 	const int numberOfInputs = classificationDataset.getNumberOfInputs();
 	const int numberOfInputValues = (m_InputSize + 1) * numberOfInputs;
@@ -28,7 +69,7 @@ LibSVMClassificationDataset::LibSVMClassificationDataset(ClassificationDataset<d
 	int globalInputId = 0, globalInputValueId = 0;
 	for(int i = 0; i < classificationDataset.getNumberOfClasses(); ++i)
 	{
-		const ClassificationDataset<double>::Class &c = classificationDataset.getClass(i);
+		const ClassificationDataset<double>::Class c = classificationDataset.getClass(i);
 
 		for(int inputId = 0; inputId < c.size(); ++inputId, ++globalInputId)
 		{
@@ -36,7 +77,7 @@ LibSVMClassificationDataset::LibSVMClassificationDataset(ClassificationDataset<d
 			prob.x[globalInputId] = &x_space[globalInputValueId];
 			//file << i+1; // XXX
 
-			const ClassificationDataset<double>::InputType &input = c[inputId];
+			const double *input = c[inputId];
 
 			for(int inputValueId = 0; inputValueId < classificationDataset.getInputSize(); ++inputValueId, ++globalInputValueId)
 			{
@@ -55,17 +96,155 @@ LibSVMClassificationDataset::LibSVMClassificationDataset(ClassificationDataset<d
 	//file.close(); // XXX
 }
 
+#endif
+
 LibSVMClassificationDataset::~LibSVMClassificationDataset()
 {
 	delete[] prob.x;
 	delete[] prob.y;
 }
 
+void LibSVMClassificationDataset::addSupportVectors(const struct svm_model *model)
+{
+	const int l = model->l, numberOfInputs = prob.l + l;
+
+#ifdef _DENSE_REP
+	svm_node *x = NULL;
+#else
+	svm_node **x = NULL;
+#endif
+	double *y = NULL;
+
+	try {
+#ifdef _DENSE_REP
+		x = new svm_node[numberOfInputs];
+
+		// The dimension of a loaded support vector stops at its last non-zero value.
+		m_SupportVectorValues = boost::shared_array<double>(new double[(size_t)l * m_InputSize]);
+		std::fill(m_SupportVectorValues.get(), m_SupportVectorValues.get() + (size_t)l * m_InputSize, 0.0);
+#else
+		x = new svm_node*[numberOfInputs];
+
+		size_t numberOfNodes = 0;
+		for(int i = 0; i < l; ++i)
+		{
+			const svm_node *node = model->SV[i];
+			while(node->index != -1)
+				++node;
+
+			numberOfNodes += node - model->SV[i] + 1;
+		}
+
+		m_SupportVectorNodes = boost::shared_array<struct svm_node>(new svm_node[numberOfNodes]);
+#endif
+		y = new double[numberOfInputs];
+	} catch (std::bad_alloc& ba) {
+		delete[] x;
+
+		throw LibSVMClassificationDatasetException("Cannot allocate memory.");
+	}
+
+	std::copy(prob.x, prob.x + prob.l, x);
+	std::copy(prob.y, prob.y + prob.l, y);
+
+	// The support vectors are sorted by class: nSV[0] vectors of class label[0], then nSV[1]...
+	int sv = 0;
+#ifndef _DENSE_REP
+	svm_node *node = m_SupportVectorNodes.get();
+#endif
+	for(int c = 0; c < model->nr_class; ++c)
+	{
+		for(int k = 0; k < model->nSV[c]; ++k, ++sv)
+		{
+			y[prob.l + sv] = model->label[c];
+
+#ifdef _DENSE_REP
+			if(model->SV[sv].dim > m_InputSize) {
+				delete[] x;
+				delete[] y;
+				throw LibSVMClassificationDatasetException("The support vectors do not have the same number of features than the patterns.");
+			}
+
+			double *values = m_SupportVectorValues.get() + (size_t)sv * m_InputSize;
+			std::copy(model->SV[sv].values, model->SV[sv].values + model->SV[sv].dim, values);
+
+			x[prob.l + sv].dim = m_InputSize;
+			x[prob.l + sv].values = values;
+#else
+			x[prob.l + sv] = node;
+
+			const svm_node *source = model->SV[sv];
+			for(; source->index != -1; ++source, ++node)
+			{
+				if(source->index > m_InputSize) {
+					delete[] x;
+					delete[] y;
+					throw LibSVMClassificationDatasetException("The support vectors do not have the same number of features than the patterns.");
+				}
+
+				*node = *source;
+			}
+
+			(node++)->index = -1;
+#endif
+		}
+	}
+
+	delete[] prob.x;
+	delete[] prob.y;
+
+	prob.x = x;
+	prob.y = y;
+	prob.l = numberOfInputs;
+}
+
 svm_problem* LibSVMClassificationDataset::getProblem()
 {
 	return &prob;
 }
 
+namespace {
+
+void destroy_subset(svm_problem *subset)
+{
+	delete[] subset->x;
+	delete[] subset->y;
+	delete subset;
+}
+
+}
+
+boost::shared_ptr< svm_problem > LibSVMClassificationDataset::getSubset(const std::vector< int > &indices) const
+{
+	boost::shared_ptr< svm_problem > subset;
+
+	try {
+		svm_problem *p = new svm_problem;
+		p->l = indices.size();
+		p->x = NULL;
+		p->y = NULL;
+		subset = boost::shared_ptr< svm_problem >(p, destroy_subset);
+
+#ifdef _DENSE_REP
+		p->x = new svm_node[indices.size()];
+#else
+		p->x = new svm_node*[indices.size()];
+#endif
+		p->y = new double[indices.size()];
+	} catch (std::bad_alloc& ba) {
+		throw LibSVMClassificationDatasetException("Cannot allocate memory.");
+	}
+
+	// Only the nodes (dense) or the pointers to the nodes (sparse) are copied.
+	for(size_t i = 0; i < indices.size(); ++i)
+	{
+		subset->x[i] = prob.x[indices[i]];
+		subset->y[i] = prob.y[indices[i]];
+	}
+
+	return subset;
+}
+
 int LibSVMClassificationDataset::getInputSize() const
 {
 	return m_InputSize;
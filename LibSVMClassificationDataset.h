@@ -7,6 +7,8 @@
 #include <log4cxx/logger.h>
 #include <libsvm/svm.h>
 #include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
 
 class LibSVMClassificationDatasetException : public std::runtime_error
 {
@@ -14,18 +16,50 @@ public:
 	LibSVMClassificationDatasetException ( const std::string &err ) : std::runtime_error(err) {}
 };
 
+/**
+ * \class LibSVMClassificationDataset
+ *
+ * \brief The training set of a SVM.
+ *
+ * When LIBSVM uses the dense representation (_DENSE_REP), each node of the problem
+ * points directly to a pattern of the ClassificationDataset, which is kept alive.
+ * Otherwise, the patterns are copied in (index, value) nodes.
+ */
 class LibSVMClassificationDataset
 {
 public:
-	LibSVMClassificationDataset(ClassificationDataset<double> &classificationDataset);
+	LibSVMClassificationDataset(boost::shared_ptr< ClassificationDataset<double> > classificationDataset);
 	~LibSVMClassificationDataset();
 
 	svm_problem* getProblem();
 
+	/**
+	 * Builds a problem made of some of the patterns of this one (e.g. a fold of a cross-validation).
+	 * The patterns are not copied: the subset must not outlive this dataset.
+	 *
+	 * @param indices The indices of the patterns in the problem.
+	 */
+	boost::shared_ptr< svm_problem > getSubset(const std::vector< int > &indices) const;
+
+	/**
+	 * Adds the support vectors of a model to the problem, each one as a pattern of the class
+	 * it supports (e.g. to train a SVM on new patterns starting from a previous one).
+	 * The support vectors are copied. Can only be called once.
+	 *
+	 * \throw LibSVMClassificationDatasetException if the support vectors have more features than the patterns.
+	 */
+	void addSupportVectors(const struct svm_model *model);
+
 	int getInputSize() const;
 
 private:
+#ifdef _DENSE_REP
+	boost::shared_ptr< ClassificationDataset<double> > m_ClassificationDataset;
+	boost::shared_array<double> m_SupportVectorValues;
+#else
 	boost::shared_array<struct svm_node> x_space;
+	boost::shared_array<struct svm_node> m_SupportVectorNodes;
+#endif
 	struct svm_problem prob;
 	int m_InputSize;
 };
@@ -0,0 +1,107 @@
+#include "MappedFile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+std::string system_error(const std::string &what, const std::string &filename)
+{
+	return what + " \"" + filename + "\" (" + std::strerror(errno) + ")";
+}
+
+}
+
+boost::shared_ptr< MappedFile > MappedFile::open(const std::string &filename)
+{
+	const int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw MappedFileException(system_error("Cannot open", filename));
+
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		::close(fd);
+		throw MappedFileException(system_error("Cannot stat", filename));
+	}
+
+	const size_t size = st.st_size;
+	char *data = NULL;
+
+	if(size > 0) {
+		void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if(addr == MAP_FAILED) {
+			::close(fd);
+			throw MappedFileException(system_error("Cannot map", filename));
+		}
+		data = static_cast< char* >(addr);
+	}
+
+	// The mapping remains valid once the descriptor is closed.
+	::close(fd);
+
+	return boost::shared_ptr< MappedFile >(new MappedFile(filename, data, size));
+}
+
+boost::shared_ptr< MappedFile > MappedFile::create(const std::string &filename, const size_t size)
+{
+	const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		throw MappedFileException(system_error("Cannot create", filename));
+
+	if(ftruncate(fd, size) != 0) {
+		::close(fd);
+		throw MappedFileException(system_error("Cannot resize", filename));
+	}
+
+	char *data = NULL;
+
+	if(size > 0) {
+		void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(addr == MAP_FAILED) {
+			::close(fd);
+			throw MappedFileException(system_error("Cannot map", filename));
+		}
+		data = static_cast< char* >(addr);
+	}
+
+	::close(fd);
+
+	return boost::shared_ptr< MappedFile >(new MappedFile(filename, data, size));
+}
+
+MappedFile::MappedFile(const std::string &filename, char *data, const size_t size) :
+	m_Filename(filename),
+	m_Data(data),
+	m_Size(size)
+{}
+
+MappedFile::~MappedFile()
+{
+	if(m_Data != NULL)
+		munmap(m_Data, m_Size);
+}
+
+char* MappedFile::data() const
+{
+	return m_Data;
+}
+
+size_t MappedFile::size() const
+{
+	return m_Size;
+}
+
+const std::string& MappedFile::getFilename() const
+{
+	return m_Filename;
+}
+
+void MappedFile::sync()
+{
+	if(m_Data != NULL && msync(m_Data, m_Size, MS_SYNC) != 0)
+		throw MappedFileException(system_error("Cannot flush", m_Filename));
+}
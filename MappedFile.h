@@ -0,0 +1,58 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+
+class MappedFileException : public std::runtime_error
+{
+public:
+	MappedFileException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+/**
+ * \class MappedFile
+ *
+ * \brief A file mapped in memory. The mapping is released when the object is destroyed.
+ */
+class MappedFile : private boost::noncopyable
+{
+public:
+	/**
+	 * Maps an existing file in memory.
+	 * The mapping is private: modifications are never written back to the file.
+	 *
+	 * @param filename The file to map.
+	 */
+	static boost::shared_ptr< MappedFile > open(const std::string &filename);
+
+	/**
+	 * Creates (or truncates) a file of the given size and maps it in memory.
+	 * The mapping is shared: modifications are written back to the file.
+	 *
+	 * @param filename The file to create.
+	 * @param size The size of the file, in bytes.
+	 */
+	static boost::shared_ptr< MappedFile > create(const std::string &filename, const size_t size);
+
+	~MappedFile();
+
+	char* data() const;
+	size_t size() const;
+	const std::string& getFilename() const;
+
+	/** Flushes the modifications to the disk. */
+	void sync();
+
+private:
+	MappedFile(const std::string &filename, char *data, const size_t size);
+
+	std::string m_Filename;
+	char *m_Data;
+	size_t m_Size;
+};
+
+#endif /* MAPPEDFILE_H */
@@ -0,0 +1,167 @@
+#include "MetaImageHeader.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <sstream>
+
+MetaImageHeader::MetaImageHeader() :
+	element_type("MET_FLOAT"),
+	number_of_channels(1),
+	compressed(false),
+	msb(false),
+	header_size(0),
+	local_data_offset(0)
+{}
+
+namespace {
+
+bool parse_bool(const std::string &value)
+{
+	return value == "True" || value == "true" || value == "1";
+}
+
+template <typename T>
+std::vector< T > parse_list(const std::string &value)
+{
+	std::vector< T > values;
+	std::istringstream stream(value);
+	T v;
+	while(stream >> v)
+		values.push_back(v);
+
+	return values;
+}
+
+}
+
+MetaImageHeader MetaImageHeader::read(const std::string &filename)
+{
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if(!file)
+		throw MetaImageException("Cannot open the MetaImage header " + filename);
+
+	MetaImageHeader header;
+	header.element_type.clear();
+
+	// ElementDataFile is always the last field of the header.
+	std::string line;
+	try {
+		while(header.element_data_file.empty() && std::getline(file, line))
+		{
+			const std::string::size_type separator = line.find('=');
+			if(separator == std::string::npos)
+				continue;
+
+			const std::string key   = boost::algorithm::trim_copy(line.substr(0, separator)),
+			                  value = boost::algorithm::trim_copy(line.substr(separator + 1));
+
+			if(key == "DimSize")
+				header.dim_size = parse_list< unsigned long >(value);
+			else if(key == "ElementSpacing")
+				header.element_spacing = parse_list< double >(value);
+			else if(key == "Offset" || key == "Origin" || key == "Position")
+				header.offset = parse_list< double >(value);
+			else if(key == "ElementType")
+				header.element_type = value;
+			else if(key == "ElementNumberOfChannels")
+				header.number_of_channels = boost::lexical_cast< unsigned int >(value);
+			else if(key == "CompressedData")
+				header.compressed = parse_bool(value);
+			else if(key == "BinaryDataByteOrderMSB" || key == "ElementByteOrderMSB")
+				header.msb = parse_bool(value);
+			else if(key == "HeaderSize")
+				header.header_size = boost::lexical_cast< long >(value);
+			else if(key == "ElementDataFile")
+				header.element_data_file = value;
+		}
+	} catch(boost::bad_lexical_cast &ex) {
+		throw MetaImageException("Invalid MetaImage header " + filename + " (" + line + ")");
+	}
+
+	if(header.element_data_file.empty() || header.dim_size.empty() || header.element_type.empty())
+		throw MetaImageException("Invalid MetaImage header " + filename);
+
+	if(header.element_data_file == "LOCAL")
+		header.local_data_offset = file.tellg();
+
+	return header;
+}
+
+size_t MetaImageHeader::getElementSize() const
+{
+	if(element_type == "MET_FLOAT")  return 4;
+	if(element_type == "MET_DOUBLE") return 8;
+	if(element_type == "MET_UCHAR")  return 1;
+	if(element_type == "MET_CHAR")   return 1;
+	if(element_type == "MET_USHORT") return 2;
+	if(element_type == "MET_SHORT")  return 2;
+	if(element_type == "MET_UINT")   return 4;
+	if(element_type == "MET_INT")    return 4;
+
+	throw MetaImageException("Unsupported element type " + element_type);
+}
+
+size_t MetaImageHeader::getDataSize() const
+{
+	size_t size = getElementSize() * number_of_channels;
+	for(std::vector< unsigned long >::const_iterator it = dim_size.begin(); it != dim_size.end(); ++it)
+		size *= *it;
+
+	return size;
+}
+
+void MetaImageHeader::write(const std::string &filename) const
+{
+	std::ofstream header;
+	header.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	try {
+		header.open(filename.c_str(), std::ios::out | std::ios::trunc);
+
+		header << "ObjectType = Image" << std::endl;
+		header << "NDims = " << dim_size.size() << std::endl;
+		header << "BinaryData = True" << std::endl;
+		header << "BinaryDataByteOrderMSB = False" << std::endl;
+		header << "CompressedData = False" << std::endl;
+
+		header << "Offset =";
+		for(size_t i = 0; i < dim_size.size(); ++i)
+			header << " " << (i < offset.size() ? offset[i] : 0.0);
+		header << std::endl;
+
+		header << "ElementSpacing =";
+		for(size_t i = 0; i < dim_size.size(); ++i)
+			header << " " << (i < element_spacing.size() ? element_spacing[i] : 1.0);
+		header << std::endl;
+
+		header << "DimSize =";
+		for(size_t i = 0; i < dim_size.size(); ++i)
+			header << " " << dim_size[i];
+		header << std::endl;
+
+		if(number_of_channels > 1)
+			header << "ElementNumberOfChannels = " << number_of_channels << std::endl;
+
+		header << "ElementType = " << element_type << std::endl;
+		header << "ElementDataFile = " << element_data_file << std::endl;
+
+		header.close();
+	} catch(std::ofstream::failure &e) {
+		throw MetaImageException("Cannot write the MetaImage header " + filename + " (" + e.what() + ")");
+	}
+}
+
+boost::shared_ptr< MappedFile > MetaImageHeader::create(const std::string &filename) const
+{
+	write(filename);
+
+	const boost::filesystem::path data_path = boost::filesystem::path(filename).parent_path() / element_data_file;
+
+	try {
+		return MappedFile::create(data_path.native(), getDataSize());
+	} catch(MappedFileException &e) {
+		throw MetaImageException(e.what());
+	}
+}
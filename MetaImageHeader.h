@@ -0,0 +1,74 @@
+#ifndef METAIMAGEHEADER_H
+#define METAIMAGEHEADER_H
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+#include "MappedFile.h"
+
+class MetaImageException : public std::runtime_error
+{
+public:
+	MetaImageException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+/**
+ * \class MetaImageHeader
+ *
+ * \brief The fields of a MetaImage (.mhd) header describing a raw volume.
+ */
+class MetaImageHeader
+{
+public:
+	MetaImageHeader();
+
+	std::vector< unsigned long > dim_size;
+	std::vector< double >        element_spacing;
+	std::vector< double >        offset;
+	std::string                  element_type;
+	unsigned int                 number_of_channels;
+
+	/** The raw data file, relative to the header ("LOCAL" if the data follows the header). */
+	std::string                  element_data_file;
+
+	bool                         compressed;
+	bool                         msb;
+
+	/** Number of bytes to skip at the beginning of the data file (-1: the data is at the end of the file). */
+	long                         header_size;
+
+	/** Position of the data in the header file, when element_data_file is "LOCAL". */
+	size_t                       local_data_offset;
+
+	/** Size of a single element (one channel of one voxel), in bytes. */
+	size_t getElementSize() const;
+
+	/** Size of the raw data, in bytes. */
+	size_t getDataSize() const;
+
+	/**
+	 * Reads a header (.mhd or .mha).
+	 *
+	 * @param filename The file to read.
+	 */
+	static MetaImageHeader read(const std::string &filename);
+
+	/**
+	 * Writes the header.
+	 *
+	 * @param filename The .mhd file to write.
+	 */
+	void write(const std::string &filename) const;
+
+	/**
+	 * Writes the header and creates its raw data file, mapped in memory.
+	 * The voxels are written to the disk through the mapping.
+	 *
+	 * @param filename The .mhd file to write.
+	 */
+	boost::shared_ptr< MappedFile > create(const std::string &filename) const;
+};
+
+#endif /* METAIMAGEHEADER_H */
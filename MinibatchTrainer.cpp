@@ -0,0 +1,335 @@
+#include "MinibatchTrainer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/** Below this number of rows, a shard costs more to schedule than to process. */
+const unsigned int MinimumRowsPerShard = 32;
+
+/** y += a * x */
+inline void axpy(const unsigned int n, const float a, const float *x, float *y)
+{
+	for(unsigned int i = 0; i < n; ++i)
+		y[i] += a * x[i];
+}
+
+inline float sigmoid(const float x)
+{
+	// exp() overflows in single precision above 88.
+	return 1.0f / (1.0f + std::exp(-std::max(x, -80.0f)));
+}
+
+}
+
+MinibatchTrainer::MinibatchTrainer(struct fann *ann, const unsigned int batch_size, const int number_of_shards) :
+	m_NeuralNetwork(ann),
+	m_BatchSize(std::max(batch_size, 1u))
+{
+	if(ann->network_type != FANN_NETTYPE_LAYER)
+		throw MinibatchTrainerException("The minibatch trainer does not support shortcut connections");
+
+	for(const struct fann_layer *layer = ann->first_layer; layer != ann->last_layer; ++layer)
+		m_LayerSizes.push_back(layer->last_neuron - layer->first_neuron - 1); // Without the bias
+
+	m_WeightOffsets.push_back(0);
+	m_NeuronOffsets.push_back(0);
+
+	unsigned int weight = 0;
+	for(size_t l = 1; l < m_LayerSizes.size(); ++l)
+	{
+		const struct fann_layer *layer = ann->first_layer + l;
+		const unsigned int number_of_inputs = m_LayerSizes[l - 1] + 1;
+
+		m_WeightOffsets.push_back(weight);
+		m_NeuronOffsets.push_back(m_Gains.size());
+
+		for(const struct fann_neuron *neuron = layer->first_neuron; neuron != layer->last_neuron - 1; ++neuron)
+		{
+			if(neuron->first_con != weight || neuron->last_con - neuron->first_con != number_of_inputs)
+				throw MinibatchTrainerException("The minibatch trainer only supports fully connected networks");
+
+			if(neuron->activation_function != FANN_SIGMOID)
+				throw MinibatchTrainerException("The minibatch trainer only supports the FANN_SIGMOID activation function");
+
+			m_Gains.push_back(2 * neuron->activation_steepness);
+			weight = neuron->last_con;
+		}
+	}
+
+	if(weight != ann->total_connections)
+		throw MinibatchTrainerException("The minibatch trainer only supports fully connected networks");
+
+	m_Weights.resize(weight);
+	m_TransposedWeights.resize(weight);
+	m_Velocities.resize(weight, 0);
+
+	const unsigned int max_number_of_shards = std::max(number_of_shards, 1);
+	m_RowsPerShard = std::min(m_BatchSize, std::max(MinimumRowsPerShard, (m_BatchSize + max_number_of_shards - 1) / max_number_of_shards));
+
+	unsigned int activations = 0;
+	for(size_t l = 0; l < m_LayerSizes.size(); ++l)
+	{
+		m_ActivationOffsets.push_back(activations);
+		activations += m_RowsPerShard * m_LayerSizes[l];
+	}
+
+	m_Workspaces.resize((m_BatchSize + m_RowsPerShard - 1) / m_RowsPerShard);
+	for(std::vector< Workspace >::iterator it = m_Workspaces.begin(); it != m_Workspaces.end(); ++it)
+	{
+		it->activations.resize(activations);
+		it->deltas.resize(activations);
+		it->gradient.resize(weight);
+	}
+}
+
+void MinibatchTrainer::import_weights()
+{
+	std::copy(m_NeuralNetwork->weights, m_NeuralNetwork->weights + m_Weights.size(), m_Weights.begin());
+	transpose_weights();
+}
+
+void MinibatchTrainer::export_weights()
+{
+	std::copy(m_Weights.begin(), m_Weights.end(), m_NeuralNetwork->weights);
+}
+
+float MinibatchTrainer::set_MSE(const double squared_error, const unsigned int number_of_patterns)
+{
+	// Same definition as fann_compute_MSE().
+	fann_reset_MSE(m_NeuralNetwork);
+	m_NeuralNetwork->MSE_value = squared_error;
+	m_NeuralNetwork->num_MSE   = number_of_patterns;
+
+	return fann_get_MSE(m_NeuralNetwork);
+}
+
+void MinibatchTrainer::transpose_weights()
+{
+	for(size_t l = 1; l < m_LayerSizes.size(); ++l)
+	{
+		const unsigned int number_of_inputs = m_LayerSizes[l - 1] + 1, size = m_LayerSizes[l];
+		const float *weights = &m_Weights[m_WeightOffsets[l]];
+		float *transposed_weights = &m_TransposedWeights[m_WeightOffsets[l]];
+
+		for(unsigned int j = 0; j < size; ++j)
+			for(unsigned int k = 0; k < number_of_inputs; ++k)
+				transposed_weights[k * size + j] = weights[j * number_of_inputs + k];
+	}
+}
+
+void MinibatchTrainer::forward(Workspace &workspace, struct fann_train_data *data, const unsigned int begin, const unsigned int end)
+{
+	const unsigned int number_of_rows = end - begin;
+
+	float *input = &workspace.activations[0];
+	for(unsigned int r = 0; r < number_of_rows; ++r)
+		std::copy(data->input[begin + r], data->input[begin + r] + m_LayerSizes[0], input + r * m_LayerSizes[0]);
+
+	for(size_t l = 1; l < m_LayerSizes.size(); ++l)
+	{
+		const unsigned int previous_size = m_LayerSizes[l - 1], size = m_LayerSizes[l];
+		const float *weights = &m_TransposedWeights[m_WeightOffsets[l]],
+		            *bias    = weights + previous_size * size,
+		            *gains   = &m_Gains[m_NeuronOffsets[l]];
+		float *output = &workspace.activations[m_ActivationOffsets[l]];
+
+		// output = input x weights + bias, one row of the output at a time.
+		for(unsigned int r = 0; r < number_of_rows; ++r)
+		{
+			const float *x = input + r * previous_size;
+			float *y = output + r * size;
+
+			std::copy(bias, bias + size, y);
+
+			for(unsigned int k = 0; k < previous_size; ++k)
+				axpy(size, x[k], weights + k * size, y);
+
+			for(unsigned int j = 0; j < size; ++j)
+				y[j] = sigmoid(gains[j] * y[j]);
+		}
+
+		input = output;
+	}
+
+	const unsigned int number_of_outputs = m_LayerSizes.back();
+	for(unsigned int r = 0; r < number_of_rows; ++r)
+	{
+		for(unsigned int j = 0; j < number_of_outputs; ++j)
+		{
+			const float diff = data->output[begin + r][j] - input[r * number_of_outputs + j];
+			workspace.squared_error += diff * diff;
+		}
+	}
+
+	workspace.number_of_patterns += number_of_rows;
+}
+
+void MinibatchTrainer::backward(Workspace &workspace, struct fann_train_data *data, const unsigned int begin, const unsigned int end)
+{
+	const unsigned int number_of_rows = end - begin;
+	const size_t last = m_LayerSizes.size() - 1;
+
+	// Error terms of the output layer: (output - desired output) * sigmoid'.
+	{
+		const unsigned int size = m_LayerSizes[last];
+		const float *output = &workspace.activations[m_ActivationOffsets[last]],
+		            *gains  = &m_Gains[m_NeuronOffsets[last]];
+		float *deltas = &workspace.deltas[m_ActivationOffsets[last]];
+
+		for(unsigned int r = 0; r < number_of_rows; ++r)
+		{
+			for(unsigned int j = 0; j < size; ++j)
+			{
+				const float y = output[r * size + j];
+				deltas[r * size + j] = (y - (float)data->output[begin + r][j]) * gains[j] * y * (1 - y);
+			}
+		}
+	}
+
+	for(size_t l = last; l > 0; --l)
+	{
+		const unsigned int previous_size = m_LayerSizes[l - 1], size = m_LayerSizes[l], number_of_inputs = previous_size + 1;
+		const float *input   = &workspace.activations[m_ActivationOffsets[l - 1]],
+		            *deltas  = &workspace.deltas[m_ActivationOffsets[l]],
+		            *weights = &m_Weights[m_WeightOffsets[l]];
+		float *gradient = &workspace.gradient[m_WeightOffsets[l]];
+
+		// gradient += deltas^T x [input 1], one neuron (a row of the weights) at a time.
+		for(unsigned int j = 0; j < size; ++j)
+		{
+			float *g = gradient + j * number_of_inputs;
+
+			for(unsigned int r = 0; r < number_of_rows; ++r)
+			{
+				const float delta = deltas[r * size + j];
+				axpy(previous_size, delta, input + r * previous_size, g);
+				g[previous_size] += delta;
+			}
+		}
+
+		if(l == 1)
+			break;
+
+		// Error terms of the previous layer: (deltas x weights) * sigmoid'.
+		const float *gains = &m_Gains[m_NeuronOffsets[l - 1]];
+		float *previous_deltas = &workspace.deltas[m_ActivationOffsets[l - 1]];
+
+		for(unsigned int r = 0; r < number_of_rows; ++r)
+		{
+			float *d = previous_deltas + r * previous_size;
+			const float *x = input + r * previous_size;
+
+			std::fill(d, d + previous_size, 0);
+
+			for(unsigned int j = 0; j < size; ++j)
+				axpy(previous_size, deltas[r * size + j], weights + j * number_of_inputs, d);
+
+			for(unsigned int k = 0; k < previous_size; ++k)
+				d[k] *= gains[k] * x[k] * (1 - x[k]);
+		}
+	}
+}
+
+float MinibatchTrainer::train_epoch(struct fann_train_data *data)
+{
+	import_weights();
+
+	const float learning_rate = fann_get_learning_rate(m_NeuralNetwork),
+	            momentum      = fann_get_learning_momentum(m_NeuralNetwork);
+
+	double squared_error = 0;
+	unsigned int number_of_patterns = 0;
+
+	for(unsigned int batch_begin = 0; batch_begin < data->num_data; batch_begin += m_BatchSize)
+	{
+		const unsigned int batch_end = std::min(batch_begin + m_BatchSize, data->num_data);
+		const int number_of_shards = (batch_end - batch_begin + m_RowsPerShard - 1) / m_RowsPerShard;
+
+		for(int s = 0; s < number_of_shards; ++s)
+		{
+			#pragma omp task firstprivate(s)
+			{
+				Workspace &workspace = m_Workspaces[s];
+				const unsigned int begin = batch_begin + s * m_RowsPerShard,
+				                   end   = std::min(begin + m_RowsPerShard, batch_end);
+
+				std::fill(workspace.gradient.begin(), workspace.gradient.end(), 0);
+				workspace.squared_error = 0;
+				workspace.number_of_patterns = 0;
+
+				forward(workspace, data, begin, end);
+				backward(workspace, data, begin, end);
+			}
+		}
+
+		#pragma omp taskwait
+
+		// Reduction in the order of the shards.
+		std::vector< float > &gradient = m_Workspaces[0].gradient;
+		for(int s = 0; s < number_of_shards; ++s)
+		{
+			if(s > 0)
+				axpy(gradient.size(), 1, &m_Workspaces[s].gradient[0], &gradient[0]);
+
+			squared_error      += m_Workspaces[s].squared_error;
+			number_of_patterns += m_Workspaces[s].number_of_patterns;
+		}
+
+		// Gradient descent on the mean loss of the minibatch.
+		const float step = learning_rate / (batch_end - batch_begin);
+		for(size_t w = 0; w < m_Weights.size(); ++w)
+		{
+			m_Velocities[w] = momentum * m_Velocities[w] - step * gradient[w];
+			m_Weights[w] += m_Velocities[w];
+		}
+
+		transpose_weights();
+	}
+
+	export_weights();
+
+	return set_MSE(squared_error, number_of_patterns);
+}
+
+void MinibatchTrainer::test_shard(Workspace &workspace, struct fann_train_data *data, const unsigned int begin, const unsigned int end)
+{
+	for(unsigned int chunk_begin = begin; chunk_begin < end; chunk_begin += m_RowsPerShard)
+		forward(workspace, data, chunk_begin, std::min(chunk_begin + m_RowsPerShard, end));
+}
+
+float MinibatchTrainer::test_data(struct fann_train_data *data)
+{
+	import_weights();
+
+	const int number_of_shards = m_Workspaces.size();
+	const unsigned int number_of_rows = data->num_data;
+
+	for(int s = 0; s < number_of_shards; ++s)
+	{
+		#pragma omp task firstprivate(s)
+		{
+			Workspace &workspace = m_Workspaces[s];
+			const unsigned int begin = (unsigned long long)number_of_rows * s / number_of_shards,
+			                   end   = (unsigned long long)number_of_rows * (s + 1) / number_of_shards;
+
+			workspace.squared_error = 0;
+			workspace.number_of_patterns = 0;
+
+			test_shard(workspace, data, begin, end);
+		}
+	}
+
+	#pragma omp taskwait
+
+	double squared_error = 0;
+	unsigned int number_of_patterns = 0;
+	for(int s = 0; s < number_of_shards; ++s)
+	{
+		squared_error      += m_Workspaces[s].squared_error;
+		number_of_patterns += m_Workspaces[s].number_of_patterns;
+	}
+
+	return set_MSE(squared_error, number_of_patterns);
+}
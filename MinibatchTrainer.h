@@ -0,0 +1,119 @@
+#ifndef MINIBATCHTRAINER_H
+#define MINIBATCHTRAINER_H
+
+#include "NeuralNetworkTrainer.h"
+
+#include <boost/noncopyable.hpp>
+#include <vector>
+#include <stdexcept>
+
+class MinibatchTrainerException : public std::runtime_error
+{
+public:
+	MinibatchTrainerException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+/**
+ * \class MinibatchTrainer
+ *
+ * \brief Trains a fully connected sigmoid network by minibatch gradient descent (MSE).
+ *
+ * Instead of running the network one pattern at a time in double precision like FANN,
+ * the patterns of a minibatch are propagated layer by layer as matrix products in single
+ * precision. The inner loops are contiguous y += a * x updates, which the compiler turns
+ * into vector instructions.
+ *
+ * The weights are kept in the layout of FANN (for each neuron, the weights of the neurons
+ * of the previous layer, then the weight of the bias). They are read from the network
+ * at the beginning of each call, and written back after each epoch: the network can be
+ * tested, copied and saved (.ann) as usual. The learning rate and the momentum are the ones of the network.
+ *
+ * The rows of a minibatch are split in shards processed as OpenMP tasks (see
+ * DataParallelTrainer), and their gradients are summed in the order of the shards.
+ */
+class MinibatchTrainer : public NeuralNetworkTrainer, private boost::noncopyable
+{
+public:
+	/**
+	 * @param ann The network to train (not owned). It must have been created by
+	 *        fann_create_standard() and use the FANN_SIGMOID activation function.
+	 * @param batch_size The number of patterns per minibatch.
+	 * @param number_of_shards The maximum number of shards (and threads) per minibatch.
+	 *
+	 * \throw MinibatchTrainerException if the network is not supported.
+	 */
+	MinibatchTrainer(struct fann *ann, const unsigned int batch_size, const int number_of_shards);
+
+	/** Performs one pass over the rows of data, in minibatches, and returns the MSE. */
+	float train_epoch(struct fann_train_data *data);
+
+	/** Computes the MSE of the network on a dataset (see fann_test_data()). */
+	float test_data(struct fann_train_data *data);
+
+private:
+	/** The buffers of a shard. */
+	struct Workspace
+	{
+		/** The outputs of each layer (number_of_rows x layer size), the input layer first. */
+		std::vector< float > activations;
+
+		/** The error terms of each layer (same layout as activations). */
+		std::vector< float > deltas;
+
+		/** The gradient of the loss, in the layout of the weights. */
+		std::vector< float > gradient;
+
+		double squared_error;
+		unsigned int number_of_patterns;
+	};
+
+	/** Reads the weights of the network. */
+	void import_weights();
+
+	/** Writes the weights in the network. */
+	void export_weights();
+
+	/** Sets the MSE of the network, and returns it. */
+	float set_MSE(const double squared_error, const unsigned int number_of_patterns);
+
+	/** Computes the transposed weights used by the forward pass. */
+	void transpose_weights();
+
+	/** Propagates rows [begin, end) of data (at most m_RowsPerShard rows) and accumulates their squared error. */
+	void forward(Workspace &workspace, struct fann_train_data *data, const unsigned int begin, const unsigned int end);
+
+	/** Accumulates the gradient of rows [begin, end) of data, after forward(). */
+	void backward(Workspace &workspace, struct fann_train_data *data, const unsigned int begin, const unsigned int end);
+
+	/** Processes rows [begin, end) of data, in chunks of m_RowsPerShard rows. */
+	void test_shard(Workspace &workspace, struct fann_train_data *data, const unsigned int begin, const unsigned int end);
+
+	struct fann *m_NeuralNetwork;
+	unsigned int m_BatchSize;
+
+	/** The number of neurons of each layer (without the bias). */
+	std::vector< unsigned int > m_LayerSizes;
+
+	/** Where the weights of each layer, and the gains of its neurons, begin. */
+	std::vector< unsigned int > m_WeightOffsets, m_NeuronOffsets;
+
+	/** Where the outputs (and the error terms) of each layer begin in a workspace. */
+	std::vector< unsigned int > m_ActivationOffsets;
+
+	/** The weights, in the layout of FANN. */
+	std::vector< float > m_Weights;
+
+	/** For each layer, (previous layer size + 1) x (layer size): the weights of the bias are the last row. */
+	std::vector< float > m_TransposedWeights;
+
+	/** The momentum term of each weight. */
+	std::vector< float > m_Velocities;
+
+	/** 2 * steepness, for each neuron (the sigmoid of FANN is 1 / (1 + exp(-2 * steepness * sum))). */
+	std::vector< float > m_Gains;
+
+	unsigned int m_RowsPerShard;
+	std::vector< Workspace > m_Workspaces;
+};
+
+#endif /* MINIBATCHTRAINER_H */
@@ -0,0 +1,234 @@
+#include "ModelFile.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+const char ModelFile::FileMagic[8] = { 'I', 'S', 'G', 'C', 'R', 'M', 'D', 'L' };
+const uint32_t ModelFile::FileVersion;
+const size_t ModelFile::Alignment;
+
+namespace {
+
+size_t align_offset(const size_t offset, const size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+}
+
+void ModelFile::BlockWriter::align(const size_t alignment)
+{
+	m_Data.resize(align_offset(m_Data.size(), alignment), 0);
+}
+
+void ModelFile::BlockWriter::writeString(const std::string &value)
+{
+	write< uint64_t >(value.size());
+	write(value.data(), value.size());
+}
+
+ModelFile::BlockReader::BlockReader(const char *data, const size_t size) :
+	m_Data(data),
+	m_Size(size),
+	m_Offset(0)
+{}
+
+void ModelFile::BlockReader::align(const size_t alignment)
+{
+	m_Offset = std::min(align_offset(m_Offset, alignment), m_Size);
+}
+
+std::string ModelFile::BlockReader::readString()
+{
+	const uint64_t size = read< uint64_t >();
+	const char *value = read< char >(size);
+
+	return std::string(value, size);
+}
+
+void ModelFile::Writer::setMetadata(const std::string &key, const std::string &value)
+{
+	m_Metadata[key] = value;
+}
+
+void ModelFile::Writer::addBlock(const BlockType type, const BlockWriter &block)
+{
+	m_Blocks.push_back(std::make_pair(type, block.getData()));
+}
+
+void ModelFile::Writer::write(const std::string &filename) const
+{
+	// The metadata are the first block.
+	BlockWriter metadata;
+	metadata.write< uint64_t >(m_Metadata.size());
+	for(std::map< std::string, std::string >::const_iterator it = m_Metadata.begin(); it != m_Metadata.end(); ++it) {
+		metadata.writeString(it->first);
+		metadata.writeString(it->second);
+	}
+
+	std::vector< std::pair< BlockType, const std::vector< char >* > > blocks;
+	blocks.push_back(std::make_pair(METADATA, &(metadata.getData())));
+	for(size_t i = 0; i < m_Blocks.size(); ++i)
+		blocks.push_back(std::make_pair(m_Blocks[i].first, &(m_Blocks[i].second)));
+
+	const boost::filesystem::path target(filename);
+	boost::filesystem::path temporary_filename;
+
+	std::ofstream file;
+	file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	try {
+		// The temporary file is unique, so concurrent writers of the same file do not share it.
+		temporary_filename = target.parent_path() / boost::filesystem::unique_path(target.filename().native() + ".%%%%-%%%%-%%%%.tmp");
+		file.open(temporary_filename.native().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+		const uint32_t version = FileVersion, number_of_blocks = blocks.size(), reserved = 0;
+
+		file.write(FileMagic, sizeof(FileMagic));
+		file.write(reinterpret_cast< const char* >(&version), sizeof(version));
+		file.write(reinterpret_cast< const char* >(&number_of_blocks), sizeof(number_of_blocks));
+
+		// The table of the blocks.
+		uint64_t offset = sizeof(FileMagic) + sizeof(version) + sizeof(number_of_blocks)
+		                + blocks.size() * (2 * sizeof(uint32_t) + 2 * sizeof(uint64_t));
+
+		for(size_t i = 0; i < blocks.size(); ++i) {
+			const uint32_t type = blocks[i].first;
+			const uint64_t size = blocks[i].second->size();
+
+			offset = align_offset(offset, Alignment);
+
+			file.write(reinterpret_cast< const char* >(&type), sizeof(type));
+			file.write(reinterpret_cast< const char* >(&reserved), sizeof(reserved));
+			file.write(reinterpret_cast< const char* >(&offset), sizeof(offset));
+			file.write(reinterpret_cast< const char* >(&size), sizeof(size));
+
+			offset += size;
+		}
+
+		const std::vector< char > padding(Alignment, 0);
+
+		for(size_t i = 0; i < blocks.size(); ++i) {
+			const size_t position = file.tellp();
+			file.write(&(padding[0]), align_offset(position, Alignment) - position);
+
+			if(!blocks[i].second->empty())
+				file.write(&((*blocks[i].second)[0]), blocks[i].second->size());
+		}
+
+		file.close();
+
+		boost::filesystem::rename(temporary_filename, filename);
+	} catch(std::ofstream::failure &e) {
+		boost::system::error_code ignored;
+		boost::filesystem::remove(temporary_filename, ignored);
+		throw ModelFileException("Cannot write the model " + filename + " (" + e.what() + ")");
+	} catch(boost::filesystem::filesystem_error &e) {
+		boost::system::error_code ignored;
+		boost::filesystem::remove(temporary_filename, ignored);
+		throw ModelFileException("Cannot write the model " + filename + " (" + e.what() + ")");
+	}
+}
+
+ModelFile::ModelFile(boost::shared_ptr< MappedFile > mapping) :
+	m_Mapping(mapping)
+{}
+
+boost::shared_ptr< ModelFile > ModelFile::open(const std::string &filename)
+{
+	boost::shared_ptr< MappedFile > mapping;
+
+	try {
+		mapping = MappedFile::open(filename);
+	} catch(MappedFileException &e) {
+		throw ModelFileException(e.what());
+	}
+
+	const char *data = mapping->data();
+	const size_t size = mapping->size();
+
+	uint32_t version, number_of_blocks;
+	const size_t header_size = sizeof(FileMagic) + sizeof(version) + sizeof(number_of_blocks);
+
+	if(size < header_size || memcmp(data, FileMagic, sizeof(FileMagic)) != 0)
+		throw ModelFileException("Invalid model " + filename);
+
+	size_t offset = sizeof(FileMagic);
+	memcpy(&version, data + offset, sizeof(version));                   offset += sizeof(version);
+	memcpy(&number_of_blocks, data + offset, sizeof(number_of_blocks)); offset += sizeof(number_of_blocks);
+
+	if(version != FileVersion)
+		throw ModelFileException("Unsupported model " + filename);
+
+	if(size < offset + number_of_blocks * (2 * sizeof(uint32_t) + 2 * sizeof(uint64_t)))
+		throw ModelFileException("Invalid model " + filename);
+
+	boost::shared_ptr< ModelFile > model(new ModelFile(mapping));
+
+	for(uint32_t i = 0; i < number_of_blocks; ++i) {
+		uint32_t type;
+		Block block;
+		memcpy(&type, data + offset, sizeof(type));                 offset += 2 * sizeof(uint32_t);
+		memcpy(&(block.offset), data + offset, sizeof(uint64_t));   offset += sizeof(uint64_t);
+		memcpy(&(block.size), data + offset, sizeof(uint64_t));     offset += sizeof(uint64_t);
+		block.type = static_cast< BlockType >(type);
+
+		if(block.offset % Alignment != 0 || block.offset > size || block.size > size - block.offset)
+			throw ModelFileException("Truncated model " + filename);
+
+		model->m_Blocks.push_back(block);
+	}
+
+	try {
+		if(model->getNumberOfBlocks(METADATA) > 0) {
+			BlockReader metadata = model->getBlock(METADATA);
+
+			const uint64_t number_of_entries = metadata.read< uint64_t >();
+			for(uint64_t i = 0; i < number_of_entries; ++i) {
+				const std::string key = metadata.readString();
+				model->m_Metadata[key] = metadata.readString();
+			}
+		}
+	} catch(ModelFileException &e) {
+		throw ModelFileException("Invalid model " + filename + " (" + e.what() + ")");
+	}
+
+	return model;
+}
+
+const std::string& ModelFile::getMetadata(const std::string &key) const
+{
+	std::map< std::string, std::string >::const_iterator it = m_Metadata.find(key);
+	if(it == m_Metadata.end())
+		throw ModelFileException("Missing \"" + key + "\" in the model " + m_Mapping->getFilename());
+
+	return it->second;
+}
+
+size_t ModelFile::getNumberOfBlocks(const BlockType type) const
+{
+	size_t count = 0;
+	for(std::vector< Block >::const_iterator it = m_Blocks.begin(); it != m_Blocks.end(); ++it)
+		if(it->type == type)
+			++count;
+
+	return count;
+}
+
+ModelFile::BlockReader ModelFile::getBlock(const BlockType type, const size_t index) const
+{
+	size_t count = 0;
+	for(std::vector< Block >::const_iterator it = m_Blocks.begin(); it != m_Blocks.end(); ++it)
+		if(it->type == type && count++ == index)
+			return BlockReader(m_Mapping->data() + it->offset, it->size);
+
+	throw ModelFileException("Missing block in the model " + m_Mapping->getFilename());
+}
+
+boost::shared_ptr< MappedFile > ModelFile::getMapping() const
+{
+	return m_Mapping;
+}
@@ -0,0 +1,171 @@
+#ifndef MODELFILE_H
+#define MODELFILE_H
+
+#include "MappedFile.h"
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <map>
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+#include <stdint.h>
+
+class ModelFileException : public std::runtime_error
+{
+public:
+	ModelFileException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+/**
+ * \class ModelFile
+ *
+ * \brief A versioned binary container storing a classifier: its metadata, its scaling
+ * parameters and its networks or support vectors, each one in its own block.
+ *
+ * The file begins with a header (magic, version, number of blocks) and a table giving the
+ * type, the offset and the size of each block. Every block starts on a multiple of Alignment
+ * bytes, and the values of a block are aligned on their own size, so they can be used
+ * directly in the mapping: a loaded file is mapped in memory (see MappedFile::open()),
+ * and the processes loading the same file share its pages.
+ *
+ * The values are stored in the native byte order.
+ */
+class ModelFile
+{
+public:
+	enum BlockType {
+		METADATA = 1,
+		SCALER,
+		NEURAL_NETWORK,
+		SVM
+	};
+
+	static const size_t Alignment = 64;
+
+	/** Builds the content of a block. */
+	class BlockWriter
+	{
+	public:
+		template <typename T>
+		void write(const T &value)
+		{
+			write(&value, 1);
+		}
+
+		/** Appends an array, aligned on the size of its values. */
+		template <typename T>
+		void write(const T *values, const size_t count)
+		{
+			align(sizeof(T));
+
+			const char *bytes = reinterpret_cast< const char* >(values);
+			m_Data.insert(m_Data.end(), bytes, bytes + count * sizeof(T));
+		}
+
+		void writeString(const std::string &value);
+
+		const std::vector< char >& getData() const { return m_Data; }
+
+	private:
+		void align(const size_t alignment);
+
+		std::vector< char > m_Data;
+	};
+
+	/** Reads the content of a block, in the order it has been written. */
+	class BlockReader
+	{
+	public:
+		BlockReader(const char *data, const size_t size);
+
+		template <typename T>
+		T read()
+		{
+			return *read<T>(1);
+		}
+
+		/**
+		 * Returns an array of the block. It is not copied: it remains valid as long as the
+		 * ModelFile exists.
+		 */
+		template <typename T>
+		const T* read(const size_t count)
+		{
+			align(sizeof(T));
+
+			if(count > (m_Size - m_Offset) / sizeof(T))
+				throw ModelFileException("Truncated block in the model file.");
+
+			const T *values = reinterpret_cast< const T* >(m_Data + m_Offset);
+			m_Offset += count * sizeof(T);
+
+			return values;
+		}
+
+		std::string readString();
+
+	private:
+		void align(const size_t alignment);
+
+		const char *m_Data;
+		size_t m_Size, m_Offset;
+	};
+
+	/** Collects the blocks of a model, and writes them in a file. */
+	class Writer
+	{
+	public:
+		void setMetadata(const std::string &key, const std::string &value);
+
+		/** Appends a block (its content is copied). */
+		void addBlock(const BlockType type, const BlockWriter &block);
+
+		/** Writes the file (through a temporary file, so a reader never sees an incomplete model). */
+		void write(const std::string &filename) const;
+
+	private:
+		std::map< std::string, std::string > m_Metadata;
+		std::vector< std::pair< BlockType, std::vector< char > > > m_Blocks;
+	};
+
+	/**
+	 * Maps a model file in memory.
+	 *
+	 * \throw ModelFileException if the file cannot be read, or has not been written by this version.
+	 */
+	static boost::shared_ptr< ModelFile > open(const std::string &filename);
+
+	/** \throw ModelFileException if the key does not exist. */
+	const std::string& getMetadata(const std::string &key) const;
+
+	size_t getNumberOfBlocks(const BlockType type) const;
+
+	/**
+	 * Returns the index-th block of a type.
+	 *
+	 * \throw ModelFileException if there is no such block.
+	 */
+	BlockReader getBlock(const BlockType type, const size_t index = 0) const;
+
+	/** The mapping of the file, which must outlive the values read from the blocks. */
+	boost::shared_ptr< MappedFile > getMapping() const;
+
+private:
+	static const char FileMagic[8];
+	static const uint32_t FileVersion = 1;
+
+	struct Block
+	{
+		BlockType type;
+		uint64_t offset, size;
+	};
+
+	ModelFile(boost::shared_ptr< MappedFile > mapping);
+
+	boost::shared_ptr< MappedFile > m_Mapping;
+	std::vector< Block > m_Blocks;
+	std::map< std::string, std::string > m_Metadata;
+};
+
+#endif /* MODELFILE_H */
@@ -1,4 +1,8 @@
 #include "NeuralNetworkPixelClassifiers.h"
+#include "DataParallelTrainer.h"
+#include "MinibatchTrainer.h"
+#include "ModelFile.h"
+#include "time_utils.h"
 #include "image_loader.h"
 
 #include "itkImageRegionConstIteratorWithIndex.h"
@@ -20,6 +24,18 @@ struct _StringComparator {
 	  bool operator() (const std::string a, const std::string b) { return a < b;}
 } StringComparator;
 
+NeuralNetworkPixelClassifiers::NeuralNetworkPixelClassifiers() :
+	m_NumberOfClassifiers(0),
+	m_Trainer(FANN_TRAINER),
+	m_BatchSize(256)
+{}
+
+void NeuralNetworkPixelClassifiers::setTrainer(const Trainer trainer, const unsigned int batch_size)
+{
+	m_Trainer = trainer;
+	m_BatchSize = batch_size;
+}
+
 void NeuralNetworkPixelClassifiers::create_neural_networks( const unsigned int inputSize, const unsigned int numberOfClassifiers, const std::vector< unsigned int > hiddenLayers, const float learning_rate )
 {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
@@ -44,20 +60,85 @@ void NeuralNetworkPixelClassifiers::create_neural_networks( const unsigned int i
 	}
 }
 
-bool score_comparator(std::pair< float, float> & a, std::pair< float, float> & b)
+/**
+ * Saves the current state of a neural network during its training, in dir/XXXXXX-checkpoint.ann
+ * (which is not loaded by NeuralNetworkPixelClassifiers::load()).
+ */
+void save_checkpoint(struct fann *ann, const std::string &dir, const int i, const unsigned int epoch)
 {
-	return a.second < b.second;
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	std::ostringstream filename;
+	filename << std::setfill('0') << std::setw(6) << (i+1) << "-checkpoint.ann";
+
+	boost::filesystem::path path = boost::filesystem::path(dir) / filename.str();
+
+	if(0 != fann_save(ann, path.native().c_str()))
+		LOG4CXX_WARN(logger, "Cannot save the checkpoint of ann #" << i << " in " << path.native());
+	else
+		LOG4CXX_INFO(logger, "Checkpoint of ann #" << i << " saved at epoch #" << epoch);
 }
 
 void NeuralNetworkPixelClassifiers::train_neural_networks(
 	FannClassificationDataset const *training_sets,
 	const unsigned int max_epoch,
 	const float mse_target,
-	FannClassificationDataset const *validation_sets )
+	FannClassificationDataset const *validation_sets,
+	const unsigned int patience,
+	const float min_improvement,
+	const unsigned int checkpoint_interval,
+	const std::string checkpoint_dir )
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	// Created beforehand, since a MinibatchTrainerException cannot be thrown from a parallel region.
+	const TrainerVector trainers = create_trainers();
+
+	#pragma omp parallel
+	#pragma omp single
+	train_in_tasks(trainers, training_sets, max_epoch, mse_target, validation_sets, patience, min_improvement, checkpoint_interval, checkpoint_dir);
+
+	for(int i = 0; i < m_NumberOfClassifiers; ++i) {
+		const double number_of_samples = (double)m_NumberOfEpochs[i] * training_sets->getSet(i)->num_data;
+
+		LOG4CXX_INFO(logger, "Ann #" << i << " trained during " << m_NumberOfEpochs[i] << " epochs ("
+		             << (m_TrainingTimes[i] > 0 ? number_of_samples / m_TrainingTimes[i] : 0) << " samples/s)");
+	}
+}
+
+NeuralNetworkPixelClassifiers::TrainerVector NeuralNetworkPixelClassifiers::create_trainers() const
+{
+	const int number_of_shards = DataParallelTrainer::getDefaultNumberOfShards();
+
+	TrainerVector trainers;
+	for(int i = 0; i < m_NumberOfClassifiers; ++i)
+	{
+		if(m_Trainer == MINIBATCH_TRAINER)
+			trainers.push_back(boost::shared_ptr< NeuralNetworkTrainer >(new MinibatchTrainer(m_NeuralNetworks[i].get(), m_BatchSize, number_of_shards)));
+		else
+			trainers.push_back(boost::shared_ptr< NeuralNetworkTrainer >(new DataParallelTrainer(m_NeuralNetworks[i].get(), number_of_shards)));
+	}
+
+	return trainers;
+}
+
+void NeuralNetworkPixelClassifiers::train_in_tasks(
+	const TrainerVector &trainers,
+	FannClassificationDataset const *training_sets,
+	const unsigned int max_epoch,
+	const float mse_target,
+	FannClassificationDataset const *validation_sets,
+	const unsigned int patience,
+	const float min_improvement,
+	const unsigned int checkpoint_interval,
+	const std::string checkpoint_dir )
 {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
 	m_TrainingScoresHistory.clear();
+	m_NumberOfEpochs.assign(m_NumberOfClassifiers, 0);
+	m_TrainingTimes.assign(m_NumberOfClassifiers, 0);
+	m_ValidationMSE.assign(m_NumberOfClassifiers, 0);
 
 	if(validation_sets != NULL) {
 		m_TrainingScoresHistory.reserve(m_NumberOfClassifiers);
@@ -65,48 +146,217 @@ void NeuralNetworkPixelClassifiers::train_neural_networks(
 			m_TrainingScoresHistory.push_back(std::vector< std::pair< float, float > >());
 	}
 
-	#pragma omp parallel for
+	/*
+	 * Each network is trained by a task (the one-vs-all training-sets all hold every pattern,
+	 * so the networks have the same cost). The epochs (and the validations) are split in shards
+	 * which are tasks as well, so the threads waiting for the shards of a network process the
+	 * shards of the others, and all the threads are used until the last network is trained
+	 * (even when there is a single network).
+	 */
 	for(int i = 0; i < m_NumberOfClassifiers; ++i)
+	#pragma omp task default(shared) firstprivate(i)
 	{
 		LOG4CXX_INFO(logger, "Training ann #" << i);
 
 		boost::shared_ptr< NeuralNetwork > current_neural_network = m_NeuralNetworks[i];
 		FannClassificationDataset::FannDataset *current_training_set = training_sets->getSet(i);
 
+		NeuralNetworkTrainer &trainer = *trainers[i];
+
 		if(validation_sets == NULL)
 		{
-			fann_train_on_data(current_neural_network.get(), current_training_set, max_epoch, 0, mse_target);
+			// Same stopping criterion as fann_train_on_data(), with checkpoints.
+			for(unsigned int j = 0; j < max_epoch; ++j) {
+				const timestamp_t epoch_start = get_timestamp();
+				const float train_mse = trainer.train_epoch( current_training_set );
+				m_TrainingTimes[i] += elapsed_time(epoch_start, get_timestamp());
+
+				m_NumberOfEpochs[i] = j + 1;
+
+				if(checkpoint_interval > 0 && (j + 1) % checkpoint_interval == 0)
+					save_checkpoint(current_neural_network.get(), checkpoint_dir, i, j);
+
+				if(train_mse <= mse_target)
+					break;
+			}
 		} else {
 			FannClassificationDataset::FannDataset *current_validation_set = validation_sets->getSet(i);
 
-			std::vector< boost::shared_ptr< NeuralNetwork > > trainingHistory;
-			trainingHistory.reserve(max_epoch);
+			/*
+			 * Only the best network (on the validation-set) is kept. Since the topology does not
+			 * change during the training, a snapshot is updated by copying the weights.
+			 */
+			boost::shared_ptr< NeuralNetwork > best_neural_network;
+			unsigned int best_neural_network_index = 0;
+			float best_validation_mse = 0;
+
+			// The validation MSE the network has to beat (by min_improvement) to reset the patience.
+			float reference_validation_mse = 0;
+			unsigned int last_improvement = 0;
 
-			for(int j = 0; j < max_epoch; ++j) {
-				float train_mse      = fann_train_epoch( current_neural_network.get(), current_training_set  ),
-				      validation_mse = fann_test_data(   current_neural_network.get(), current_validation_set );
+			for(unsigned int j = 0; j < max_epoch; ++j) {
+				const timestamp_t epoch_start = get_timestamp();
+				const float train_mse = trainer.train_epoch( current_training_set );
+				m_TrainingTimes[i] += elapsed_time(epoch_start, get_timestamp());
 
-				trainingHistory.push_back( boost::shared_ptr< NeuralNetwork >( fann_copy(current_neural_network.get()), fann_destroy ) );
+				const float validation_mse = trainer.test_data( current_validation_set );
 
 				m_TrainingScoresHistory[i].push_back(std::make_pair(train_mse, validation_mse));
 
 				LOG4CXX_INFO(logger, "MSE for ann #" << i << "; " << j << "; " << train_mse << "; " << validation_mse);
-			}
 
-			const int best_neural_network_index = std::distance(
-					m_TrainingScoresHistory[i].begin(),
-					std::min_element(m_TrainingScoresHistory[i].begin(), m_TrainingScoresHistory[i].end(), score_comparator)
-				);
+				m_NumberOfEpochs[i] = j + 1;
+
+				if(!best_neural_network) {
+					best_neural_network = boost::shared_ptr< NeuralNetwork >( fann_copy(current_neural_network.get()), fann_destroy );
+					best_neural_network_index = j;
+					best_validation_mse = validation_mse;
+					reference_validation_mse = validation_mse;
+				} else if(validation_mse < best_validation_mse) {
+					std::copy(current_neural_network->weights,
+					          current_neural_network->weights + current_neural_network->total_connections,
+					          best_neural_network->weights);
+					best_neural_network_index = j;
+					best_validation_mse = validation_mse;
+				}
+
+				if(checkpoint_interval > 0 && (j + 1) % checkpoint_interval == 0)
+					save_checkpoint(current_neural_network.get(), checkpoint_dir, i, j);
+
+				if(validation_mse < reference_validation_mse - min_improvement) {
+					reference_validation_mse = validation_mse;
+					last_improvement = j;
+				} else if(patience > 0 && j - last_improvement >= patience) {
+					LOG4CXX_INFO(logger, "Early stopping of ann #" << i << " at training-iteration #" << j
+					             << ": no improvement of the validation MSE since training-iteration #" << last_improvement);
+					break;
+				}
+			}
 
-			LOG4CXX_INFO(logger, "Best neural network for dataset #" << i << " obtained at training-iteration #" << best_neural_network_index << ": MSE=" << m_TrainingScoresHistory[i][best_neural_network_index].second);
+			LOG4CXX_INFO(logger, "Best neural network for dataset #" << i << " obtained at training-iteration #" << best_neural_network_index << ": MSE=" << best_validation_mse);
 
-			m_NeuralNetworks[i] = boost::shared_ptr< NeuralNetwork >(trainingHistory[best_neural_network_index]);
+			m_NeuralNetworks[i] = best_neural_network;
+			m_ValidationMSE[i] = best_validation_mse;
 
 			fann_test_data(m_NeuralNetworks[i].get(), current_validation_set);
 		}
 
 		LOG4CXX_INFO(logger, "MSE for ann #" << i << ": " << fann_get_MSE(m_NeuralNetworks[i].get()));
 	}
+
+	#pragma omp taskwait
+}
+
+/**
+ * Writes a network in a block of a model file: the sizes of its layers, the parameters of
+ * its training, the activation function and steepness of each neuron, and its weights.
+ *
+ * \return false if the network is not a fully connected layered network (as created by
+ * fann_create_standard()), which is the only kind of network read by read_neural_network().
+ */
+bool write_neural_network(ModelFile::BlockWriter &block, struct fann *ann)
+{
+	if(ann->network_type != FANN_NETTYPE_LAYER)
+		return false;
+
+	std::vector< unsigned int > layers(fann_get_num_layers(ann));
+	fann_get_layer_array(ann, layers.data());
+
+	std::vector< uint32_t > activation_functions;
+	std::vector< fann_type > steepnesses;
+
+	unsigned int weight = 0;
+	for(size_t l = 1; l < layers.size(); ++l)
+	{
+		const struct fann_layer *layer = ann->first_layer + l;
+
+		for(const struct fann_neuron *neuron = layer->first_neuron; neuron != layer->last_neuron - 1; ++neuron)
+		{
+			if(neuron->first_con != weight || neuron->last_con - neuron->first_con != layers[l - 1] + 1)
+				return false;
+
+			activation_functions.push_back(neuron->activation_function);
+			steepnesses.push_back(neuron->activation_steepness);
+			weight = neuron->last_con;
+		}
+	}
+
+	const std::vector< uint32_t > layer_sizes(layers.begin(), layers.end());
+
+	block.write< uint32_t >(sizeof(fann_type));
+	block.write< uint32_t >(layer_sizes.size());
+	block.write(layer_sizes.data(), layer_sizes.size());
+	block.write< uint32_t >(fann_get_training_algorithm(ann));
+	block.write< uint32_t >(fann_get_train_stop_function(ann));
+	block.write< double >(fann_get_learning_rate(ann));
+	block.write< double >(fann_get_learning_momentum(ann));
+	block.write< double >(fann_get_bit_fail_limit(ann));
+	block.write(activation_functions.data(), activation_functions.size());
+	block.write(steepnesses.data(), steepnesses.size());
+	block.write< uint64_t >(ann->total_connections);
+	block.write(ann->weights, ann->total_connections);
+
+	return true;
+}
+
+/** Creates a network from a block written by write_neural_network(). */
+struct fann* read_neural_network(ModelFile::BlockReader &block)
+{
+	const uint32_t value_size = block.read< uint32_t >();
+	if(value_size != sizeof(fann_type))
+		throw std::runtime_error("The neural networks of the model file do not have the expected value type.");
+
+	const uint32_t number_of_layers = block.read< uint32_t >();
+	const uint32_t *layer_sizes = block.read< uint32_t >(number_of_layers);
+	const std::vector< unsigned int > layers(layer_sizes, layer_sizes + number_of_layers);
+
+	const uint32_t training_algorithm = block.read< uint32_t >(), train_stop_function = block.read< uint32_t >();
+	const double learning_rate = block.read< double >(), learning_momentum = block.read< double >(), bit_fail_limit = block.read< double >();
+
+	unsigned int number_of_neurons = 0;
+	for(size_t l = 1; l < layers.size(); ++l)
+		number_of_neurons += layers[l];
+
+	const uint32_t *activation_functions = block.read< uint32_t >(number_of_neurons);
+	const fann_type *steepnesses = block.read< fann_type >(number_of_neurons);
+
+	const uint64_t number_of_weights = block.read< uint64_t >();
+	const fann_type *weights = block.read< fann_type >(number_of_weights);
+
+	if(layers.size() < 2)
+		throw std::runtime_error("Invalid neural network in the model file.");
+
+	struct fann *ann = fann_create_standard_array(layers.size(), layers.data());
+	if(ann == NULL)
+		throw std::runtime_error("Cannot create the neural network read from the model file.");
+
+	if(ann->total_connections != number_of_weights)
+	{
+		fann_destroy(ann);
+		throw std::runtime_error("Invalid neural network in the model file.");
+	}
+
+	fann_set_training_algorithm(ann, static_cast< enum fann_train_enum >(training_algorithm));
+	fann_set_train_stop_function(ann, static_cast< enum fann_stopfunc_enum >(train_stop_function));
+	fann_set_learning_rate(ann, learning_rate);
+	fann_set_learning_momentum(ann, learning_momentum);
+	fann_set_bit_fail_limit(ann, bit_fail_limit);
+
+	unsigned int n = 0;
+	for(size_t l = 1; l < layers.size(); ++l)
+	{
+		const struct fann_layer *layer = ann->first_layer + l;
+
+		for(struct fann_neuron *neuron = layer->first_neuron; neuron != layer->last_neuron - 1; ++neuron, ++n)
+		{
+			neuron->activation_function = static_cast< enum fann_activationfunc_enum >(activation_functions[n]);
+			neuron->activation_steepness = steepnesses[n];
+		}
+	}
+
+	std::copy(weights, weights + number_of_weights, ann->weights);
+
+	return ann;
 }
 
 void NeuralNetworkPixelClassifiers::save(const std::string dir)
@@ -114,6 +364,8 @@ void NeuralNetworkPixelClassifiers::save(const std::string dir)
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 	LOG4CXX_INFO(logger, "Saving neural networks in " << dir);
 
+	saveScaler(dir);
+
 	for(int i = 0; i < m_NumberOfClassifiers; ++i) {
 		std::ostringstream filename;
 		filename << std::setfill('0') << std::setw(6) << (i+1) << ".ann";
@@ -145,6 +397,36 @@ void NeuralNetworkPixelClassifiers::save(const std::string dir)
 			}
 		}
 	}
+
+	save_model_file((boost::filesystem::path(dir) / "model.bin").native());
+}
+
+void NeuralNetworkPixelClassifiers::save_model_file(const std::string &filename) const
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	ModelFile::Writer file;
+	file.setMetadata("classifier", "neural-networks");
+
+	saveScaler(file);
+
+	for(int i = 0; i < m_NumberOfClassifiers; ++i) {
+		ModelFile::BlockWriter block;
+
+		if(!write_neural_network(block, m_NeuralNetworks[i].get())) {
+			LOG4CXX_WARN(logger, "Ann #" << i << " is not a fully connected layered network, the model file " << filename << " is not written");
+
+			// A stale model file would be loaded instead of the .ann files.
+			if(boost::filesystem::exists(filename))
+				boost::filesystem::remove(filename);
+
+			return;
+		}
+
+		file.addBlock(ModelFile::NEURAL_NETWORK, block);
+	}
+
+	file.write(filename);
 }
 
 void NeuralNetworkPixelClassifiers::load(const std::string dir)
@@ -153,6 +435,50 @@ void NeuralNetworkPixelClassifiers::load(const std::string dir)
 	LOG4CXX_INFO(logger, "Loading neural networks from " << dir);
 
 	m_TrainingScoresHistory.clear();
+	m_NeuralNetworks.clear();
+
+	const boost::filesystem::path model_path = boost::filesystem::path(dir) / "model.bin";
+
+	if(boost::filesystem::exists(model_path))
+		load_model_file(model_path.native());
+	else
+		load_ann_files(dir);
+
+	m_NumberOfClassifiers = m_NeuralNetworks.size();
+	m_NumberOfClasses = 1 == m_NumberOfClassifiers ? 2 : m_NumberOfClassifiers;
+
+	if(m_NeuralNetworks.empty())
+		throw std::runtime_error("No neural network found in " + dir);
+
+	m_InputSize = fann_get_num_input(m_NeuralNetworks.front().get());
+
+	LOG4CXX_INFO(logger, "Number of components per pixel: " << m_InputSize);
+
+	if(m_Scaler && m_Scaler->getInputSize() != m_InputSize)
+		throw std::runtime_error("The scaling parameters do not match the neural networks.");
+}
+
+void NeuralNetworkPixelClassifiers::load_model_file(const std::string &filename)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+	LOG4CXX_INFO(logger, "Loading neural networks from " << filename);
+
+	boost::shared_ptr< ModelFile > file = ModelFile::open(filename);
+
+	if(file->getMetadata("classifier") != "neural-networks")
+		throw std::runtime_error("The model " + filename + " is not a neural network classifier.");
+
+	for(size_t i = 0; i < file->getNumberOfBlocks(ModelFile::NEURAL_NETWORK); ++i) {
+		ModelFile::BlockReader block = file->getBlock(ModelFile::NEURAL_NETWORK, i);
+		m_NeuralNetworks.push_back( boost::shared_ptr< NeuralNetwork >( read_neural_network(block), fann_destroy ) );
+	}
+
+	loadScaler(*file);
+}
+
+void NeuralNetworkPixelClassifiers::load_ann_files(const std::string &dir)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
 	const boost::regex config_file_filter( "\\d{6,6}.ann" );
 	std::vector< std::string > config_files;
@@ -173,9 +499,6 @@ void NeuralNetworkPixelClassifiers::load(const std::string dir)
 
 	std::sort(config_files.begin(), config_files.end(), StringComparator);
 
-	m_NumberOfClassifiers = config_files.size();
-	m_NumberOfClasses = 1 == m_NumberOfClassifiers ? 2 : m_NumberOfClassifiers;
-
 	for(std::vector<std::string>::const_iterator it = config_files.begin(); it != config_files.end(); ++it) {
 		LOG4CXX_INFO(logger, "Loading neural network from " << *it);
 
@@ -187,18 +510,19 @@ void NeuralNetworkPixelClassifiers::load(const std::string dir)
 		m_NeuralNetworks.push_back( boost::shared_ptr< NeuralNetwork >( ann, fann_destroy ) );
 	}
 
-	m_InputSize = fann_get_num_input(m_NeuralNetworks.front().get());
-
-	LOG4CXX_INFO(logger, "Number of components per pixel: " << m_InputSize);
+	loadScaler(dir);
 }
 
 std::vector<float> NeuralNetworkPixelClassifiers::classify(const std::vector< fann_type > &input) const
 {
 	std::vector<float> result(m_NumberOfClassifiers);
 
+	fann_type buffer[input.size()];
+	fann_type *pattern = const_cast<fann_type *>( scale(input, buffer) );
+
 	for(int i = 0; i < m_NumberOfClassifiers; ++i)
 	{
-		double* r = fann_run( m_NeuralNetworks[i].get(), const_cast<fann_type *>( input.data() ) );
+		double* r = fann_run( m_NeuralNetworks[i].get(), pattern );
 		result[i] = r[0];
 	}
 
@@ -11,6 +11,7 @@
 #include "Classifier.h"
 
 #include "FannClassificationDataset.h"
+#include "NeuralNetworkTrainer.h"
 
 // Forward declaration
 namespace std {
@@ -20,26 +21,104 @@ namespace std {
 class NeuralNetworkPixelClassifiers : public Classifier< fann_type >
 {
 public:
+	/** The algorithm used to train the networks. */
+	enum Trainer {
+		/** The training algorithm of FANN (iRPROP- by default), see DataParallelTrainer. */
+		FANN_TRAINER = 0,
+		/** Minibatch gradient descent, see MinibatchTrainer. */
+		MINIBATCH_TRAINER
+	};
+
+	NeuralNetworkPixelClassifiers();
+
 	void create_neural_networks( const unsigned int inputSize, const unsigned int numberOfClassifiers, const std::vector< unsigned int > hiddenLayers, const float learning_rate );
+	/**
+	 * Trains the neural networks. When a validation-set is provided, the networks are trained
+	 * during max_epoch epochs and the best one (on the validation-set) is kept.
+	 *
+	 * @param patience If not 0, the training of a network stops when its validation MSE has not
+	 *        improved by more than min_improvement during patience epochs.
+	 * @param checkpoint_interval If not 0, the networks are saved in checkpoint_dir every checkpoint_interval epochs.
+	 */
 	void train_neural_networks(
 		FannClassificationDataset const *training_sets,
 		const unsigned int max_epoch,
 		const float mse_target,
-		FannClassificationDataset const *validation_sets );
+		FannClassificationDataset const *validation_sets,
+		const unsigned int patience = 0,
+		const float min_improvement = 0,
+		const unsigned int checkpoint_interval = 0,
+		const std::string checkpoint_dir = "" );
+
+	/**
+	 * Selects the algorithm used by train_neural_networks() (FANN_TRAINER by default).
+	 *
+	 * @param batch_size The number of patterns per minibatch (MINIBATCH_TRAINER only).
+	 */
+	void setTrainer(const Trainer trainer, const unsigned int batch_size);
 
+	/**
+	 * Saves each network in dir/XXXXXX.ann, and all of them (with the scaling parameters)
+	 * in dir/model.bin (see ModelFile).
+	 */
 	void save(const std::string dir);
+
+	/** Loads dir/model.bin if it exists, the .ann files of dir otherwise. */
 	void load(const std::string dir);
+
 	std::vector<float> classify(const std::vector< InputValueType > &input) const;
 
 	const unsigned int getNumberOfClassifiers() const { return m_NumberOfClassifiers; }
 
+	/** The number of epochs performed by each network during the last training. */
+	const std::vector< unsigned int >& getNumberOfEpochs() const { return m_NumberOfEpochs; }
+
+	/** The MSE of each network on its validation-set, after the last training with a validation-set. */
+	const std::vector< float >& getValidationMSE() const { return m_ValidationMSE; }
+
 private:
+	friend class NeuralNetworkSweep;
+
 	typedef struct fann NeuralNetwork;
 	typedef std::vector< boost::shared_ptr< NeuralNetwork > > NeuralNetworkVector;
+	typedef std::vector< boost::shared_ptr< NeuralNetworkTrainer > > TrainerVector;
+
+	/** Creates the trainers of the networks (they cannot be created in a parallel region, since they can throw). */
+	TrainerVector create_trainers() const;
+
+	/** Writes the networks in a model file, if they can be stored in it (see write_neural_network()). */
+	void save_model_file(const std::string &filename) const;
+
+	void load_model_file(const std::string &filename);
+
+	/** Loads the .ann files of dir, and dir/scaling.dat. */
+	void load_ann_files(const std::string &dir);
+
+	/**
+	 * Trains each network in a task (see train_neural_networks()), and waits for them.
+	 * Called from a parallel region, so several classifiers can be trained by the same threads.
+	 */
+	void train_in_tasks(
+		const TrainerVector &trainers,
+		FannClassificationDataset const *training_sets,
+		const unsigned int max_epoch,
+		const float mse_target,
+		FannClassificationDataset const *validation_sets,
+		const unsigned int patience,
+		const float min_improvement,
+		const unsigned int checkpoint_interval,
+		const std::string checkpoint_dir );
 
 	unsigned int m_NumberOfClassifiers;
 	NeuralNetworkVector m_NeuralNetworks;
 	std::vector< std::vector< std::pair< float, float > > > m_TrainingScoresHistory;
+	std::vector< unsigned int > m_NumberOfEpochs;
+
+	/** The time spent in the training epochs (the validations excluded) by each network. */
+	std::vector< float > m_TrainingTimes;
+	std::vector< float > m_ValidationMSE;
+	Trainer m_Trainer;
+	unsigned int m_BatchSize;
 };
 
 #endif /* NEURALNETWORKPIXELCLASSIFIERS_H */
@@ -0,0 +1,132 @@
+#include "NeuralNetworkSweep.h"
+#include "time_utils.h"
+
+#include "log4cxx/logger.h"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+std::string format_hidden_layers(const std::vector< unsigned int > &hidden_layers)
+{
+	std::ostringstream s;
+	for(std::vector< unsigned int >::const_iterator it = hidden_layers.begin(); it != hidden_layers.end(); ++it)
+		s << (it == hidden_layers.begin() ? "" : " ") << *it;
+
+	return s.str();
+}
+
+}
+
+NeuralNetworkSweep::NeuralNetworkSweep(const std::vector< std::vector< unsigned int > > &hidden_layers, const std::vector< float > &learning_rates)
+{
+	for(std::vector< std::vector< unsigned int > >::const_iterator layers = hidden_layers.begin(); layers != hidden_layers.end(); ++layers)
+	{
+		for(std::vector< float >::const_iterator learning_rate = learning_rates.begin(); learning_rate != learning_rates.end(); ++learning_rate)
+		{
+			Candidate candidate;
+			candidate.hidden_layers = *layers;
+			candidate.learning_rate = *learning_rate;
+			candidate.validation_mse = 0;
+			candidate.number_of_epochs = 0;
+			candidate.training_time = 0;
+
+			m_Candidates.push_back(candidate);
+		}
+	}
+}
+
+boost::shared_ptr< NeuralNetworkPixelClassifiers > NeuralNetworkSweep::run(
+	FannClassificationDataset const *training_sets,
+	FannClassificationDataset const *validation_sets,
+	const unsigned int max_epoch,
+	const float mse_target,
+	const unsigned int patience,
+	const float min_improvement,
+	const NeuralNetworkPixelClassifiers::Trainer trainer,
+	const unsigned int batch_size )
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	LOG4CXX_INFO(logger, "Training " << m_Candidates.size() << " neural network classifiers");
+
+	// The trainers are created beforehand, since they cannot be created in a parallel region.
+	std::vector< NeuralNetworkPixelClassifiers::TrainerVector > trainers;
+	for(std::vector< Candidate >::iterator it = m_Candidates.begin(); it != m_Candidates.end(); ++it)
+	{
+		it->classifier = boost::shared_ptr< NeuralNetworkPixelClassifiers >(new NeuralNetworkPixelClassifiers());
+		it->classifier->create_neural_networks(training_sets->getInputSize(), training_sets->getNumberOfDatasets(), it->hidden_layers, it->learning_rate);
+		it->classifier->setTrainer(trainer, batch_size);
+
+		trainers.push_back(it->classifier->create_trainers());
+	}
+
+	#pragma omp parallel
+	#pragma omp single
+	for(size_t c = 0; c < m_Candidates.size(); ++c)
+	#pragma omp task default(shared) firstprivate(c)
+	{
+		Candidate &candidate = m_Candidates[c];
+
+		const timestamp_t start = get_timestamp();
+		candidate.classifier->train_in_tasks(trainers[c], training_sets, max_epoch, mse_target, validation_sets, patience, min_improvement, 0, "");
+		candidate.training_time = elapsed_time(start, get_timestamp());
+	}
+
+	size_t best = 0;
+	for(size_t c = 0; c < m_Candidates.size(); ++c)
+	{
+		Candidate &candidate = m_Candidates[c];
+
+		const std::vector< float > &validation_mse = candidate.classifier->getValidationMSE();
+		const std::vector< unsigned int > &number_of_epochs = candidate.classifier->getNumberOfEpochs();
+
+		for(size_t i = 0; i < validation_mse.size(); ++i)
+		{
+			candidate.validation_mse += validation_mse[i] / validation_mse.size();
+			candidate.number_of_epochs += (float)number_of_epochs[i] / number_of_epochs.size();
+		}
+
+		LOG4CXX_INFO(logger, "Hidden layers: " << format_hidden_layers(candidate.hidden_layers) << ", learning rate: " << candidate.learning_rate
+		             << ": validation MSE=" << candidate.validation_mse << " (" << candidate.number_of_epochs << " epochs, " << candidate.training_time << "s)");
+
+		if(candidate.validation_mse < m_Candidates[best].validation_mse)
+			best = c;
+	}
+
+	LOG4CXX_INFO(logger, "Best neural network classifier: hidden layers: " << format_hidden_layers(m_Candidates[best].hidden_layers)
+	             << ", learning rate: " << m_Candidates[best].learning_rate);
+
+	// Only the networks of the best classifier are kept.
+	boost::shared_ptr< NeuralNetworkPixelClassifiers > best_classifier = m_Candidates[best].classifier;
+	for(std::vector< Candidate >::iterator it = m_Candidates.begin(); it != m_Candidates.end(); ++it)
+		it->classifier.reset();
+
+	return best_classifier;
+}
+
+void NeuralNetworkSweep::save(const std::string dir) const
+{
+	boost::filesystem::path path = boost::filesystem::path(dir) / "sweep.csv";
+
+	std::ofstream file;
+	file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+	try {
+		file.open(path.native().c_str(), std::ios::out | std::ios::trunc);
+
+		file << "hidden_layers,learning_rate,validation_mse,epochs,training_time" << std::endl;
+
+		for(std::vector< Candidate >::const_iterator it = m_Candidates.begin(); it != m_Candidates.end(); ++it)
+			file << format_hidden_layers(it->hidden_layers) << "," << it->learning_rate << "," << it->validation_mse << ","
+			     << it->number_of_epochs << "," << it->training_time << std::endl;
+
+		file.close();
+	} catch(std::ofstream::failure &e) {
+		throw std::runtime_error("Cannot save the results of the sweep in " + path.native() + " (" + e.what() + ")");
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef NEURALNETWORKSWEEP_H
+#define NEURALNETWORKSWEEP_H
+
+#include "NeuralNetworkPixelClassifiers.h"
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <string>
+
+/**
+ * \class NeuralNetworkSweep
+ *
+ * \brief Trains a neural network classifier for each combination of hidden layers and
+ * learning rate, and keeps the best one on the validation-sets.
+ *
+ * All the classifiers are trained at the same time on the same (read-only) datasets: each
+ * classifier is a task, which creates a task per network (see
+ * NeuralNetworkPixelClassifiers::train_neural_networks()), so the candidates share the threads.
+ */
+class NeuralNetworkSweep
+{
+public:
+	/** A combination of parameters, and the results of its classifier. */
+	struct Candidate
+	{
+		std::vector< unsigned int > hidden_layers;
+		float learning_rate;
+
+		boost::shared_ptr< NeuralNetworkPixelClassifiers > classifier;
+
+		/** The mean of the validation MSE of the networks of the classifier. */
+		float validation_mse;
+
+		/** The mean number of epochs performed by the networks of the classifier. */
+		float number_of_epochs;
+
+		/** The time spent to train the classifier (concurrently with the others), in seconds. */
+		float training_time;
+	};
+
+	NeuralNetworkSweep(const std::vector< std::vector< unsigned int > > &hidden_layers, const std::vector< float > &learning_rates);
+
+	/**
+	 * Creates and trains the classifiers (see NeuralNetworkPixelClassifiers::create_neural_networks()
+	 * and NeuralNetworkPixelClassifiers::train_neural_networks()).
+	 *
+	 * \return The classifier having the lowest validation MSE.
+	 */
+	boost::shared_ptr< NeuralNetworkPixelClassifiers > run(
+		FannClassificationDataset const *training_sets,
+		FannClassificationDataset const *validation_sets,
+		const unsigned int max_epoch,
+		const float mse_target,
+		const unsigned int patience,
+		const float min_improvement,
+		const NeuralNetworkPixelClassifiers::Trainer trainer,
+		const unsigned int batch_size );
+
+	/** Writes the results of the candidates in dir/sweep.csv. */
+	void save(const std::string dir) const;
+
+	const std::vector< Candidate >& getCandidates() const { return m_Candidates; }
+
+private:
+	std::vector< Candidate > m_Candidates;
+};
+
+#endif /* NEURALNETWORKSWEEP_H */
@@ -0,0 +1,26 @@
+#ifndef NEURALNETWORKTRAINER_H
+#define NEURALNETWORKTRAINER_H
+
+#include "doublefann.h"
+
+/**
+ * \class NeuralNetworkTrainer
+ *
+ * \brief Trains a FANN neural network, one epoch at a time.
+ *
+ * After each call, the weights and the MSE of the network are up to date, so the network
+ * can be copied, tested or saved with the functions of FANN.
+ */
+class NeuralNetworkTrainer
+{
+public:
+	virtual ~NeuralNetworkTrainer() {}
+
+	/** Performs one training epoch, and returns the MSE (see fann_train_epoch()). */
+	virtual float train_epoch(struct fann_train_data *data) = 0;
+
+	/** Computes the MSE of the network on a dataset (see fann_test_data()). */
+	virtual float test_data(struct fann_train_data *data) = 0;
+};
+
+#endif /* NEURALNETWORKTRAINER_H */
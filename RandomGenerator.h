@@ -0,0 +1,56 @@
+#ifndef RANDOMGENERATOR_H
+#define RANDOMGENERATOR_H
+
+#include <stdint.h>
+
+/**
+ * \class RandomGenerator
+ *
+ * \brief A small and fast pseudo-random generator (xorshift64*).
+ *
+ * The sequence only depends on the seed, so the results are reproducible
+ * from one run (or one platform) to another.
+ */
+class RandomGenerator
+{
+public:
+	RandomGenerator(const uint64_t seed) : m_State(mix(seed)) {
+		if(m_State == 0)
+			m_State = 0x9E3779B97F4A7C15ULL;
+	}
+
+	/**
+	 * Builds the seed of an independent generator, for example one per thread or per image.
+	 *
+	 * @param seed The seed of the parent generator.
+	 * @param stream The index of the derived generator.
+	 */
+	static uint64_t derive(const uint64_t seed, const uint64_t stream) {
+		return mix(seed ^ mix(stream + 1));
+	}
+
+	uint64_t next() {
+		m_State ^= m_State >> 12;
+		m_State ^= m_State << 25;
+		m_State ^= m_State >> 27;
+		return m_State * 0x2545F4914F6CDD1DULL;
+	}
+
+	/** Returns an integer in [0, n). */
+	uint64_t uniform(const uint64_t n) {
+		return next() % n;
+	}
+
+private:
+	/** splitmix64 finalizer, spreads the bits of the seeds. */
+	static uint64_t mix(uint64_t z) {
+		z += 0x9E3779B97F4A7C15ULL;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	uint64_t m_State;
+};
+
+#endif /* RANDOMGENERATOR_H */
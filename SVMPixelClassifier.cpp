@@ -1,17 +1,387 @@
 #include "SVMPixelClassifier.h"
+#include "RandomGenerator.h"
+#include "ModelFile.h"
 #include <libsvm/svm.h>
 #include "log4cxx/logger.h"
 #include <boost/filesystem.hpp>
 #include <iostream>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+struct svm_parameter create_parameters(const double C, const double gamma, const int probability)
+{
+	struct svm_parameter param;
+	param.svm_type = C_SVC;
+	param.kernel_type = RBF;
+	param.degree = 3;
+	param.gamma = gamma;
+	param.coef0 = 0;
+	param.nu = 0.5;
+	param.cache_size = 100;
+	param.C = C;
+	param.eps = 1e-3;
+	param.p = 0.1;
+	param.shrinking = 1;
+	param.probability = probability;
+	param.nr_weight = 0;
+	param.weight_label = NULL;
+	param.weight = NULL;
+
+	return param;
+}
+
+/** The i-th pattern of a problem, as expected by svm_predict(). */
+const struct svm_node* get_pattern(const svm_problem *problem, const int i)
+{
+#ifdef _DENSE_REP
+	return problem->x + i;
+#else
+	return problem->x[i];
+#endif
+}
+
+/**
+ * Assigns the patterns to the folds: the patterns of each class are shuffled, then dealt
+ * to the folds in turn, so every fold has the same proportion of each class.
+ */
+std::vector< int > assign_folds(const svm_problem *problem, const unsigned int number_of_folds, const uint64_t seed)
+{
+	std::map< double, std::vector< int > > classes;
+	for(int i = 0; i < problem->l; ++i)
+		classes[problem->y[i]].push_back(i);
+
+	std::vector< int > folds(problem->l);
+	unsigned int next_fold = 0, class_index = 0;
+
+	for(std::map< double, std::vector< int > >::iterator it = classes.begin(); it != classes.end(); ++it, ++class_index)
+	{
+		std::vector< int > &indices = it->second;
+
+		RandomGenerator generator(RandomGenerator::derive(seed, class_index));
+		for(size_t i = indices.size(); i > 1; --i)
+			std::swap(indices[i - 1], indices[generator.uniform(i)]);
+
+		for(size_t i = 0; i < indices.size(); ++i, next_fold = (next_fold + 1) % number_of_folds)
+			folds[indices[i]] = next_fold;
+	}
+
+	return folds;
+}
+
+/** Copies an array allocated with malloc() (as LIBSVM does). */
+template <typename T>
+T* copy_array(const T *source, const size_t size)
+{
+	if(source == NULL)
+		return NULL;
+
+	T *copy = (T*)malloc(sizeof(T) * std::max< size_t >(size, 1));
+	if(copy == NULL)
+		throw std::runtime_error("Cannot allocate memory to copy the SVM.");
+
+	std::copy(source, source + size, copy);
+
+	return copy;
+}
+
+/**
+ * Deep copy of a model, which owns its support vectors (free_sv = 1), in the same way as a model
+ * loaded by svm_load_model(). The model returned by svm_train() references the nodes of the
+ * training problem instead.
+ */
+struct svm_model* copy_model(const struct svm_model *model)
+{
+	struct svm_model *copy = (struct svm_model*)calloc(1, sizeof(struct svm_model));
+	if(copy == NULL)
+		throw std::runtime_error("Cannot allocate memory to copy the SVM.");
+
+	const int l = model->l, nr_class = model->nr_class, nr_pairs = nr_class * (nr_class - 1) / 2;
+
+	copy->param = model->param;
+	copy->nr_class = nr_class;
+	copy->l = l;
+	copy->free_sv = 1;
+
+#ifdef _DENSE_REP
+	// svm_free_model_content() frees the values of every support vector.
+	copy->SV = copy_array(model->SV, l);
+	for(int i = 0; i < l; ++i)
+		copy->SV[i].values = copy_array(model->SV[i].values, model->SV[i].dim);
+#else
+	// svm_free_model_content() frees the block of nodes starting at SV[0] (as allocated by svm_load_model()).
+	size_t number_of_nodes = 0;
+	for(int i = 0; i < l; ++i)
+	{
+		const struct svm_node *node = model->SV[i];
+		while(node->index != -1)
+			++node;
+
+		number_of_nodes += node - model->SV[i] + 1;
+	}
+
+	copy->SV = (struct svm_node**)malloc(sizeof(struct svm_node*) * std::max(l, 1));
+	struct svm_node *x_space = (struct svm_node*)malloc(sizeof(struct svm_node) * std::max< size_t >(number_of_nodes, 1));
+	if(copy->SV == NULL || x_space == NULL)
+		throw std::runtime_error("Cannot allocate memory to copy the SVM.");
+
+	for(int i = 0; i < l; ++i)
+	{
+		copy->SV[i] = x_space;
+
+		const struct svm_node *node = model->SV[i];
+		do {
+			*x_space++ = *node;
+		} while((node++)->index != -1);
+	}
+#endif
+
+	copy->sv_coef = (double**)malloc(sizeof(double*) * std::max(nr_class - 1, 1));
+	if(copy->sv_coef == NULL)
+		throw std::runtime_error("Cannot allocate memory to copy the SVM.");
+
+	for(int i = 0; i < nr_class - 1; ++i)
+		copy->sv_coef[i] = copy_array(model->sv_coef[i], l);
+
+	copy->rho   = copy_array(model->rho, nr_pairs);
+	copy->probA = copy_array(model->probA, nr_pairs);
+	copy->probB = copy_array(model->probB, nr_pairs);
+	copy->label = copy_array(model->label, nr_class);
+	copy->nSV   = copy_array(model->nSV, nr_class);
+
+#if LIBSVM_VERSION >= 313
+	copy->sv_indices = copy_array(model->sv_indices, l);
+#endif
+
+#if LIBSVM_VERSION >= 325
+	copy->prob_density_marks = copy_array(model->prob_density_marks, 10); // nr_marks in svm.cpp
+#endif
+
+	return copy;
+}
+
+void destroy_model(struct svm_model *model)
+{
+	svm_free_and_destroy_model(&model);
+}
+
+/**
+ * Writes a model in a block of a model file. The support vectors are written as they are
+ * stored in memory (nodes or rows of values), so read_model() can use them in place.
+ */
+void write_model(ModelFile::BlockWriter &block, const struct svm_model *model)
+{
+	const int l = model->l, nr_class = model->nr_class, nr_pairs = nr_class * (nr_class - 1) / 2;
+	const int probability = model->probA != NULL && model->probB != NULL;
+
+#ifdef _DENSE_REP
+	block.write< uint32_t >(1);
+#else
+	block.write< uint32_t >(0);
+#endif
+	block.write< uint32_t >(sizeof(struct svm_node));
+
+	block.write< int32_t >(model->param.svm_type);
+	block.write< int32_t >(model->param.kernel_type);
+	block.write< int32_t >(model->param.degree);
+	block.write< double >(model->param.gamma);
+	block.write< double >(model->param.coef0);
+
+	block.write< int32_t >(nr_class);
+	block.write< int32_t >(l);
+	block.write< int32_t >(probability);
+
+	block.write(model->label, nr_class);
+	block.write(model->nSV, nr_class);
+	block.write(model->rho, nr_pairs);
+
+	if(probability) {
+		block.write(model->probA, nr_pairs);
+		block.write(model->probB, nr_pairs);
+	}
+
+	for(int i = 0; i < nr_class - 1; ++i)
+		block.write(model->sv_coef[i], l);
+
+#ifdef _DENSE_REP
+	// Every support vector is padded to the same dimension.
+	int dim = 0;
+	for(int i = 0; i < l; ++i)
+		dim = std::max(dim, model->SV[i].dim);
+
+	block.write< uint64_t >(dim);
+
+	std::vector< double > values(dim);
+	for(int i = 0; i < l; ++i)
+	{
+		std::fill(std::copy(model->SV[i].values, model->SV[i].values + model->SV[i].dim, values.begin()), values.end(), 0);
+		block.write(values.data(), dim);
+	}
+#else
+	// The nodes of all the support vectors (each one terminated by index -1), and where each one begins.
+	std::vector< uint64_t > offsets(l);
+	std::vector< struct svm_node > nodes;
+	for(int i = 0; i < l; ++i)
+	{
+		offsets[i] = nodes.size();
+
+		const struct svm_node *node = model->SV[i];
+		do {
+			nodes.push_back(*node);
+		} while((node++)->index != -1);
+	}
+
+	block.write< uint64_t >(nodes.size());
+	block.write(offsets.data(), l);
+	block.write(nodes.data(), nodes.size());
+#endif
+}
+
+/**
+ * Creates a model from a block written by write_model(). The support vectors are not copied:
+ * they point to the block, so the model must be destroyed before the model file.
+ */
+struct svm_model* read_model(ModelFile::BlockReader &block)
+{
+	const uint32_t dense = block.read< uint32_t >(), node_size = block.read< uint32_t >();
+
+#ifdef _DENSE_REP
+	if(dense != 1 || node_size != sizeof(struct svm_node))
+#else
+	if(dense != 0 || node_size != sizeof(struct svm_node))
+#endif
+		throw std::runtime_error("The SVM of the model file does not use the representation of the support vectors of this build.");
+
+	const int svm_type = block.read< int32_t >(), kernel_type = block.read< int32_t >(), degree = block.read< int32_t >();
+	const double gamma = block.read< double >(), coef0 = block.read< double >();
+
+	const int nr_class = block.read< int32_t >(), l = block.read< int32_t >(), probability = block.read< int32_t >();
+
+	if(nr_class < 2 || l < 0)
+		throw std::runtime_error("Invalid SVM in the model file.");
+
+	const int nr_pairs = nr_class * (nr_class - 1) / 2;
+
+	const int *label = block.read< int >(nr_class);
+	const int *nSV = block.read< int >(nr_class);
+	const double *rho = block.read< double >(nr_pairs);
+	const double *probA = probability ? block.read< double >(nr_pairs) : NULL;
+	const double *probB = probability ? block.read< double >(nr_pairs) : NULL;
+
+	std::vector< const double* > sv_coef(nr_class - 1);
+	for(int i = 0; i < nr_class - 1; ++i)
+		sv_coef[i] = block.read< double >(l);
+
+#ifdef _DENSE_REP
+	const uint64_t dim = block.read< uint64_t >();
+	const double *values = block.read< double >(l * dim);
+#else
+	const uint64_t number_of_nodes = block.read< uint64_t >();
+	const uint64_t *offsets = block.read< uint64_t >(l);
+	const struct svm_node *nodes = block.read< struct svm_node >(number_of_nodes);
+
+	for(int i = 0; i < l; ++i)
+		if(offsets[i] >= number_of_nodes)
+			throw std::runtime_error("Invalid SVM in the model file.");
+
+	if(number_of_nodes > 0 && nodes[number_of_nodes - 1].index != -1)
+		throw std::runtime_error("Invalid SVM in the model file.");
+#endif
+
+	struct svm_model *model = (struct svm_model*)calloc(1, sizeof(struct svm_model));
+	if(model == NULL)
+		throw std::runtime_error("Cannot allocate memory to load the SVM.");
+
+	model->param = create_parameters(0, gamma, probability);
+	model->param.svm_type = svm_type;
+	model->param.kernel_type = kernel_type;
+	model->param.degree = degree;
+	model->param.coef0 = coef0;
+
+	model->nr_class = nr_class;
+	model->l = l;
+
+	// svm_free_model_content() does not free the support vectors, which belong to the model file.
+	model->free_sv = 0;
+
+#ifdef _DENSE_REP
+	model->SV = (struct svm_node*)malloc(sizeof(struct svm_node) * std::max(l, 1));
+	if(model->SV == NULL)
+		throw std::runtime_error("Cannot allocate memory to load the SVM.");
+
+	for(int i = 0; i < l; ++i)
+	{
+		model->SV[i].dim = dim;
+		model->SV[i].values = const_cast< double* >(values + i * dim);
+	}
+#else
+	model->SV = (struct svm_node**)malloc(sizeof(struct svm_node*) * std::max(l, 1));
+	if(model->SV == NULL)
+		throw std::runtime_error("Cannot allocate memory to load the SVM.");
+
+	for(int i = 0; i < l; ++i)
+		model->SV[i] = const_cast< struct svm_node* >(nodes + offsets[i]);
+#endif
+
+	model->sv_coef = (double**)malloc(sizeof(double*) * (nr_class - 1));
+	if(model->sv_coef == NULL)
+		throw std::runtime_error("Cannot allocate memory to load the SVM.");
+
+	for(int i = 0; i < nr_class - 1; ++i)
+		model->sv_coef[i] = copy_array(sv_coef[i], l);
+
+	model->rho   = copy_array(rho, nr_pairs);
+	model->probA = copy_array(probA, nr_pairs);
+	model->probB = copy_array(probB, nr_pairs);
+	model->label = copy_array(label, nr_class);
+	model->nSV   = copy_array(nSV, nr_class);
+
+	return model;
+}
+
+/** Destroys a model read by read_model(), then releases its model file. */
+struct MappedModelDeleter
+{
+	boost::shared_ptr< ModelFile > file;
+
+	void operator()(struct svm_model *model) const
+	{
+		destroy_model(model);
+	}
+};
+
+}
 
 void SVMPixelClassifier::load(const std::string dir)
 {
-	boost::filesystem::path path = boost::filesystem::path(dir) / "svm.model";
-	svm_model *m;
-	if((m = svm_load_model(path.native().c_str())) == 0)
-		throw std::runtime_error("Cannot load the SVM from " + path.native());
-	else
-		model = boost::shared_ptr<struct svm_model>(m, svm_free_model_content);
+	m_SearchScores.clear();
+
+	const boost::filesystem::path model_path = boost::filesystem::path(dir) / "model.bin";
+
+	if(boost::filesystem::exists(model_path)) {
+		boost::shared_ptr< ModelFile > file = ModelFile::open(model_path.native());
+
+		if(file->getMetadata("classifier") != "svm")
+			throw std::runtime_error("The model " + model_path.native() + " is not a SVM classifier.");
+
+		ModelFile::BlockReader block = file->getBlock(ModelFile::SVM);
+		const MappedModelDeleter deleter = { file };
+		model = boost::shared_ptr<struct svm_model>(read_model(block), deleter);
+
+		loadScaler(*file);
+	} else {
+		boost::filesystem::path path = boost::filesystem::path(dir) / "svm.model";
+		svm_model *m;
+		if((m = svm_load_model(path.native().c_str())) == 0)
+			throw std::runtime_error("Cannot load the SVM from " + path.native());
+		else
+			model = boost::shared_ptr<struct svm_model>(m, destroy_model);
+
+		loadScaler(dir);
+	}
 
 	m_NumberOfClasses = svm_get_nr_class(model.get());
 	m_InputSize = 0;
@@ -28,20 +398,66 @@ void SVMPixelClassifier::save(const std::string dir)
 	{
 		throw std::runtime_error("Cannot save the SVM in " + path.native());
 	}
+
+	saveScaler(dir);
+
+	ModelFile::Writer file;
+	file.setMetadata("classifier", "svm");
+	saveScaler(file);
+
+	ModelFile::BlockWriter block;
+	write_model(block, model.get());
+	file.addBlock(ModelFile::SVM, block);
+	file.write((boost::filesystem::path(dir) / "model.bin").native());
+
+	if(!m_SearchScores.empty()) {
+		path = boost::filesystem::path(dir) / "svm-search-scores.dat";
+
+		std::ofstream score_file;
+		score_file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+		try {
+			score_file.open(path.native().c_str(), std::ios::out | std::ios::trunc);
+
+			for(std::vector< GridPoint >::const_iterator it = m_SearchScores.begin(); it != m_SearchScores.end(); ++it)
+				score_file << it->C << "\t" << it->gamma << "\t" << it->accuracy << std::endl;
+
+			score_file.close();
+		} catch(std::ofstream::failure &e) {
+			throw std::runtime_error("Cannot save the SVM search scores in " + path.native() + " (" + e.what() + ")");
+		}
+	}
+}
+
+const struct svm_model* SVMPixelClassifier::getModel() const
+{
+	return model.get();
 }
 
 std::vector<float> SVMPixelClassifier::classify(const std::vector< InputValueType > &input) const
 {
 	double estimates[m_NumberOfClasses];
+
+	InputValueType buffer[input.size()];
+	const InputValueType *pattern = scale(input, buffer);
+
+#ifdef _DENSE_REP
+	struct svm_node x;
+	x.dim = input.size();
+	x.values = const_cast< double* >(pattern);
+
+	svm_predict_probability(model.get(), &x, estimates);
+#else
 	struct svm_node x[input.size()+1];
 	for(int i = 0; i < input.size(); ++i)
 	{
 		x[i].index = i+1;
-		x[i].value = input[i];
+		x[i].value = pattern[i];
 	}
 	x[input.size()].index = -1;
 
 	svm_predict_probability(model.get(), x, estimates);
+#endif
 
 	std::vector<float> output(m_NumberOfClasses, 0);
 	for(int i = 0; i < m_NumberOfClasses; ++i)
@@ -52,53 +468,124 @@ std::vector<float> SVMPixelClassifier::classify(const std::vector< InputValueTyp
 	return output;
 }
 
-bool SVMPixelClassifier::train(LibSVMClassificationDataset *trainingSet)
+size_t SVMPixelClassifier::search(LibSVMClassificationDataset *trainingSet, std::vector< GridPoint > &grid, const unsigned int number_of_folds, const uint64_t seed) const
 {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
-	struct svm_parameter param;
-	param.svm_type = C_SVC;
-	param.kernel_type = RBF;
-	param.degree = 3;
-	param.gamma = 1.0 / (trainingSet->getInputSize() + 1);        // 1/num_features
-	param.coef0 = 0;
-	param.nu = 0.5;
-	param.cache_size = 100;
-	param.C = 1;
-	param.eps = 1e-3;
-	param.p = 0.1;
-	param.shrinking = 1;
-	param.probability = 1; // Compute probabilities
-	param.nr_weight = 0;
-	param.weight_label = NULL;
-	param.weight = NULL;
+	const svm_problem *problem = trainingSet->getProblem();
+	const std::vector< int > folds = assign_folds(problem, number_of_folds, seed);
+
+	// The folds are views on the training-set.
+	std::vector< boost::shared_ptr< svm_problem > > training_folds, validation_folds;
+	for(unsigned int f = 0; f < number_of_folds; ++f)
+	{
+		std::vector< int > training_indices, validation_indices;
+		for(int i = 0; i < problem->l; ++i)
+			(folds[i] == f ? validation_indices : training_indices).push_back(i);
 
-	const char *error_msg;
-	error_msg = svm_check_parameter(trainingSet->getProblem(), &param);
+		training_folds.push_back(trainingSet->getSubset(training_indices));
+		validation_folds.push_back(trainingSet->getSubset(validation_indices));
+	}
 
-	if(error_msg) {
-		LOG4CXX_FATAL(logger, error_msg);
-		return false;
+	// Each (point, fold) pair is a job, the jobs are dynamically distributed to the threads.
+	const int number_of_jobs = grid.size() * number_of_folds;
+	std::vector< int > number_of_hits(number_of_jobs, 0);
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int job = 0; job < number_of_jobs; ++job)
+	{
+		const GridPoint &point = grid[job / number_of_folds];
+		const unsigned int f = job % number_of_folds;
+
+		const struct svm_parameter param = create_parameters(point.C, point.gamma, 0);
+		struct svm_model *m = svm_train(training_folds[f].get(), &param);
+
+		const svm_problem *validation = validation_folds[f].get();
+		for(int i = 0; i < validation->l; ++i)
+			if(svm_predict(m, get_pattern(validation, i)) == validation->y[i])
+				++number_of_hits[job];
+
+		svm_free_and_destroy_model(&m);
+	}
+
+	size_t best = 0;
+	for(size_t p = 0; p < grid.size(); ++p)
+	{
+		int hits = 0;
+		for(unsigned int f = 0; f < number_of_folds; ++f)
+			hits += number_of_hits[p * number_of_folds + f];
+
+		grid[p].accuracy = (double)hits / problem->l;
+
+		LOG4CXX_INFO(logger, "SVM cross-validation: C=" << grid[p].C << ", gamma=" << grid[p].gamma << ": accuracy=" << grid[p].accuracy);
+
+		if(grid[p].accuracy > grid[best].accuracy)
+			best = p;
 	}
+
+	return best;
+}
+
+bool SVMPixelClassifier::train(LibSVMClassificationDataset *trainingSet, const std::vector< double > &C_values, const std::vector< double > &gamma_values,
+                               const unsigned int number_of_folds, const uint64_t seed)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
 	svm_set_print_string_function(NULL);
 
-	struct svm_model *m = svm_train(trainingSet->getProblem(), &param);
-	boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
-	if(0 != svm_save_model(ph.native().c_str(), m))
-		throw std::runtime_error("Cannot temporary save the SVM in " + ph.native());
+	std::vector< GridPoint > grid;
+	for(std::vector< double >::const_iterator C = C_values.begin(); C != C_values.end(); ++C)
+	{
+		if(gamma_values.empty()) {
+			const GridPoint point = { *C, 1.0 / (trainingSet->getInputSize() + 1), 0 }; // 1/num_features
+			grid.push_back(point);
+		} else {
+			for(std::vector< double >::const_iterator gamma = gamma_values.begin(); gamma != gamma_values.end(); ++gamma) {
+				const GridPoint point = { *C, *gamma, 0 };
+				grid.push_back(point);
+			}
+		}
+	}
 
-	svm_free_and_destroy_model(&m);
+	if(grid.empty()) {
+		LOG4CXX_FATAL(logger, "No value of C is given to train the SVM");
+		return false;
+	}
 
-	if((m = svm_load_model(ph.native().c_str())) == 0)
-		throw std::runtime_error("Cannot load the temporary SVM from " + ph.native());
-	else
-		model = boost::shared_ptr<struct svm_model>(m, svm_free_model_content);
+	for(std::vector< GridPoint >::const_iterator it = grid.begin(); it != grid.end(); ++it)
+	{
+		const struct svm_parameter param = create_parameters(it->C, it->gamma, 1);
+		const char *error_msg = svm_check_parameter(trainingSet->getProblem(), &param);
+
+		if(error_msg) {
+			LOG4CXX_FATAL(logger, error_msg);
+			return false;
+		}
+	}
 
-	boost::filesystem::remove(ph);
+	m_SearchScores.clear();
 
-	//model = boost::shared_ptr<struct svm_model>(svm_train(trainingSet->getProblem(), &param), svm_free_model_content);
+	size_t best = 0;
+	if(grid.size() > 1) {
+		LOG4CXX_INFO(logger, "Searching the parameters of the SVM among " << grid.size() << " points (" << number_of_folds << "-fold cross-validation)");
+
+		best = search(trainingSet, grid, number_of_folds, seed);
+		m_SearchScores = grid;
+
+		LOG4CXX_INFO(logger, "Best parameters of the SVM: C=" << grid[best].C << ", gamma=" << grid[best].gamma << " (accuracy=" << grid[best].accuracy << ")");
+	}
+
+	// Compute probabilities
+	struct svm_parameter param = create_parameters(grid[best].C, grid[best].gamma, 1);
+
+	struct svm_model *m = svm_train(trainingSet->getProblem(), &param);
+	// The model references the patterns of the training-set, it gets its own copy of the support vectors.
+	model = boost::shared_ptr<struct svm_model>(copy_model(m), destroy_model);
+
+	svm_free_and_destroy_model(&m);
 
 	m_NumberOfClasses = svm_get_nr_class(model.get());
+	m_InputSize = trainingSet->getInputSize();
 
 	return true;
 }
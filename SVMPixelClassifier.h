@@ -4,6 +4,7 @@
 #include "Classifier.h"
 #include "LibSVMClassificationDataset.h"
 #include <boost/shared_array.hpp>
+#include <stdint.h>
 
 class SVMPixelClassifier : public Classifier<double>
 {
@@ -13,10 +14,38 @@ public:
 
 	std::vector<float> classify(const std::vector< InputValueType >&) const;
 
-	bool train(LibSVMClassificationDataset *trainingSet);
+	/** The trained or loaded model (NULL if none). */
+	const struct svm_model* getModel() const;
+
+	/**
+	 * Trains a C-SVC with a RBF kernel. When several values of C or gamma are given, every
+	 * point of the grid is evaluated by a stratified cross-validation (the points and the folds
+	 * are evaluated in parallel), and the SVM is trained on the whole training-set with the point
+	 * having the best accuracy. The scores of the grid are saved by save().
+	 *
+	 * @param gamma_values If empty, 1 / (number of features + 1).
+	 * @param number_of_folds The number of folds of the cross-validation (at least 2 for a search).
+	 * @param seed Seed of the random assignment of the patterns to the folds.
+	 */
+	bool train(LibSVMClassificationDataset *trainingSet, const std::vector< double > &C_values, const std::vector< double > &gamma_values,
+	           const unsigned int number_of_folds, const uint64_t seed);
 
 private:
+	/** A point of the grid, and its cross-validation accuracy. */
+	struct GridPoint
+	{
+		double C, gamma, accuracy;
+	};
+
+	/**
+	 * Evaluates the points of the grid.
+	 *
+	 * \return The index of the best point.
+	 */
+	size_t search(LibSVMClassificationDataset *trainingSet, std::vector< GridPoint > &grid, const unsigned int number_of_folds, const uint64_t seed) const;
+
 	boost::shared_ptr<struct svm_model> model;
+	std::vector< GridPoint > m_SearchScores;
 };
 
 #endif /* SVMPIXELCLASSIFIER_H */
@@ -0,0 +1,105 @@
+#include "TrainingSetCache.h"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+namespace {
+
+/** 64 bits FNV-1a hash. */
+class Hash
+{
+public:
+	Hash() : m_Value(0xcbf29ce484222325ULL) {}
+
+	void add(const void *data, const size_t size) {
+		const unsigned char *bytes = static_cast< const unsigned char* >(data);
+		for(size_t i = 0; i < size; ++i) {
+			m_Value ^= bytes[i];
+			m_Value *= 0x100000001b3ULL;
+		}
+	}
+
+	void add(const std::string &s) {
+		add(s.c_str(), s.size() + 1);
+	}
+
+	void add(const uint64_t v) {
+		add(&v, sizeof(v));
+	}
+
+	uint64_t value() const { return m_Value; }
+
+private:
+	uint64_t m_Value;
+};
+
+void add_file(Hash &hash, const boost::filesystem::path &path)
+{
+	hash.add(path.string());
+	hash.add(static_cast< uint64_t >(boost::filesystem::file_size(path)));
+	hash.add(static_cast< uint64_t >(boost::filesystem::last_write_time(path)));
+}
+
+/** Adds a file, or the files of a directory (image series). */
+void add_path(Hash &hash, const std::string &filename)
+{
+	const boost::filesystem::path path = boost::filesystem::absolute(filename);
+
+	if(boost::filesystem::is_directory(path)) {
+		std::vector< boost::filesystem::path > entries;
+		std::copy(boost::filesystem::directory_iterator(path), boost::filesystem::directory_iterator(), std::back_inserter(entries));
+		std::sort(entries.begin(), entries.end());
+
+		hash.add(path.string());
+		hash.add(static_cast< uint64_t >(entries.size()));
+
+		for(std::vector< boost::filesystem::path >::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+			if(boost::filesystem::is_regular_file(*it))
+				add_file(hash, *it);
+		}
+	} else {
+		add_file(hash, path);
+	}
+}
+
+}
+
+TrainingSetCache::TrainingSetCache(const std::string &directory) :
+	m_Directory(directory)
+{
+	try {
+		boost::filesystem::create_directories(directory);
+	} catch(boost::filesystem::filesystem_error &e) {
+		throw TrainingSetCacheException("Cannot create the training-set cache " + directory + " (" + e.what() + ")");
+	}
+}
+
+std::string TrainingSetCache::getFilename(const std::vector< std::string > &image_filenames,
+                                          const std::vector< std::string > &class_filenames,
+                                          const size_t max_samples_per_class,
+                                          const uint64_t seed) const
+{
+	Hash hash;
+
+	try {
+		hash.add(static_cast< uint64_t >(image_filenames.size()));
+		for(std::vector< std::string >::const_iterator it = image_filenames.begin(); it != image_filenames.end(); ++it)
+			add_path(hash, *it);
+
+		hash.add(static_cast< uint64_t >(class_filenames.size()));
+		for(std::vector< std::string >::const_iterator it = class_filenames.begin(); it != class_filenames.end(); ++it)
+			add_path(hash, *it);
+	} catch(boost::filesystem::filesystem_error &e) {
+		throw TrainingSetCacheException(e.what());
+	}
+
+	hash.add(static_cast< uint64_t >(max_samples_per_class));
+	hash.add(seed);
+
+	std::stringstream filename;
+	filename << std::hex << std::setw(16) << std::setfill('0') << hash.value() << ".dataset";
+
+	return (boost::filesystem::path(m_Directory) / filename.str()).string();
+}
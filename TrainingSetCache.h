@@ -0,0 +1,46 @@
+#ifndef TRAININGSETCACHE_H
+#define TRAININGSETCACHE_H
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+class TrainingSetCacheException : public std::runtime_error
+{
+public:
+	TrainingSetCacheException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+/**
+ * \class TrainingSetCache
+ *
+ * \brief A directory holding the datasets extracted from sets of images and masks
+ * (see ClassificationDataset::save()).
+ *
+ * A dataset is identified by a hash of the paths, sizes and modification times of
+ * its images and masks (or of the slices of the image series), and of the sampling
+ * parameters. Modifying a file therefore invalidates the datasets built from it.
+ */
+class TrainingSetCache
+{
+public:
+	/**
+	 * @param directory The directory of the cache. It is created if it does not exist.
+	 */
+	TrainingSetCache(const std::string &directory);
+
+	/**
+	 * Returns the file holding the dataset built from a set of images and masks.
+	 * The file may not exist yet.
+	 */
+	std::string getFilename(const std::vector< std::string > &image_filenames,
+	                        const std::vector< std::string > &class_filenames,
+	                        const size_t max_samples_per_class,
+	                        const uint64_t seed) const;
+
+private:
+	std::string m_Directory;
+};
+
+#endif /* TRAININGSETCACHE_H */
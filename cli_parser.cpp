@@ -3,10 +3,16 @@
 #include <boost/filesystem.hpp>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <vector>
 
+#include "ParseUtils.h"
+
 #include "log4cxx/logger.h"
 
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+
 template< typename TElemType >
 std::ostream &operator<<(std::ostream &s, const std::vector< TElemType >& v)
 {
@@ -39,6 +45,32 @@ std::istream& operator>>(std::istream& in, CliParser::ClassifierType& ct)
 	return in;
 }
 
+std::istream& operator>>(std::istream& in, CliParser::FeatureScaling& fs)
+{
+	std::string token;
+	in >> token;
+	if (token == "none")
+		fs = CliParser::NO_SCALING;
+	else if (token == "standard")
+		fs = CliParser::STANDARD_SCALING;
+	else if (token == "minmax")
+		fs = CliParser::MINMAX_SCALING;
+	else throw boost::program_options::invalid_option_value("Invalid feature scaling");
+	return in;
+}
+
+std::istream& operator>>(std::istream& in, CliParser::AnnTrainer& at)
+{
+	std::string token;
+	in >> token;
+	if (token == "fann")
+		at = CliParser::FANN_TRAINER;
+	else if (token == "minibatch")
+		at = CliParser::MINIBATCH_TRAINER;
+	else throw boost::program_options::invalid_option_value("Invalid neural network trainer");
+	return in;
+}
+
 CliParser::CliParser()
 {}
 
@@ -63,6 +95,17 @@ CliParser::ParseResult CliParser::parse_argv(int argc, char ** argv)
 		("export-dir,E",
 			po::value< std::string >(&(this->export_dir))->default_value(""),
 			"Export directory.")
+		("batch-manifest",
+			po::value< std::string >(&(this->batch_manifest))->default_value(""),
+			"Segments several images with the same classifier, in a single process. Each line of the file describes an image: the input image, the region of interest (- if none) and the export directory, separated by spaces. Replaces --input-image, --roi and --export-dir.")
+		("daemon",
+			po::value< std::string >(&(this->daemon_socket))->default_value(""),
+			"Runs as a daemon keeping the classifier loaded, and segments the images requested on this Unix domain socket (see the README). Replaces --input-image, --roi and --export-dir.")
+		("daemon-workers",
+			po::value< StrictlyPositiveInteger >(&(this->daemon_workers))->default_value(1),
+			"Number of images the daemon segments at the same time.")
+		("export-probability-maps",
+			"Exports the classification (f0) and regularized (fn) maps of each class as raw float volumes (MetaImage).")
 		("export-interval,e",
 			po::value< PositiveInteger >(&(this->export_interval))->default_value(0),
 			"Export interval during regularization.")
@@ -84,6 +127,20 @@ CliParser::ParseResult CliParser::parse_argv(int argc, char ** argv)
 		("classifier-config-dir",
 			po::value< std::string >(&(this->classifier_config_dir))->default_value(""),
 			"Directory containing the classifier configuration files.")
+		("warm-start",
+			"Starts the training from the classifier stored in the classifier configuration directory (and with its feature scaling), which is then replaced. The neural networks continue their training on the new training-set (during --ann-max-epoch epochs), the support vectors of the SVM are added to the new training-set.")
+		("classifier-max-samples-per-class",
+			po::value< PositiveInteger >(&(this->classifier_max_samples_per_class))->default_value(0),
+			"Maximum number of pixels per class used for training, uniformly sampled among the pixels of the classes of all the images (0: no limit).")
+		("random-seed",
+			po::value< PositiveInteger >(&(this->random_seed))->default_value(0),
+			"Seed of the random generator used to sample and shuffle the training pixels.")
+		("feature-scaling",
+			po::value< FeatureScaling >(&(this->feature_scaling))->default_value(NO_SCALING, "none"),
+			"Scaling of the features, computed on the training-set and stored with the classifier. (none, standard: zero mean and unit variance, or minmax: [0, 1])")
+		("training-cache-dir",
+			po::value< std::string >(&(this->training_cache_dir))->default_value(""),
+			"Directory where the training and validation sets extracted from the images are cached. They are extracted again when an image or a mask is modified.")
 		("ann-hidden-layer",
 			po::value< HiddenLayerVector >(&(this->ann_hidden_layers))->multitoken()->default_value(HiddenLayerVector(1, 3)),
 			"Number of neurons per hidden layer (default: one layer of 3 neurons).")
@@ -96,6 +153,27 @@ CliParser::ParseResult CliParser::parse_argv(int argc, char ** argv)
 		("ann-mse-target",
 			po::value< Float >(&(this->ann_mse_target))->default_value(0.0001),
 			"Mean squared error targeted by the neural networks training algorithm.")
+		("ann-trainer",
+			po::value< AnnTrainer >(&(this->ann_trainer))->default_value(FANN_TRAINER, "fann"),
+			"Training algorithm of the neural networks. (fann: iRPROP- from FANN, or minibatch: minibatch gradient descent in single precision, using --ann-learning-rate)")
+		("ann-batch-size",
+			po::value< StrictlyPositiveInteger >(&(this->ann_batch_size))->default_value(256),
+			"Number of pixels per minibatch, when --ann-trainer is minibatch.")
+		("ann-patience",
+			po::value< PositiveInteger >(&(this->ann_patience))->default_value(0),
+			"Stops the training of a neural network when its validation MSE has not improved during this number of epochs (0: never stops before --ann-max-epoch).")
+		("ann-min-improvement",
+			po::value< Float >(&(this->ann_min_improvement))->default_value(0),
+			"Minimum decrease of the validation MSE considered as an improvement by --ann-patience.")
+		("ann-checkpoint-interval",
+			po::value< PositiveInteger >(&(this->ann_checkpoint_interval))->default_value(0),
+			"Saves the neural networks being trained in the classifier configuration directory every N epochs (0: never).")
+		("ann-sweep-hidden-layers",
+			po::value< std::vector< std::string > >(&(this->ann_sweep_hidden_layers_args))->multitoken(),
+			"Hidden layers of the neural networks to compare, the sizes of the layers being separated by commas (e.g. \"3 10,5\": one layer of 3 neurons, then two layers of 10 and 5 neurons). A classifier is trained for each combination of hidden layers and learning rate (see --ann-sweep-learning-rate), and the one having the lowest validation MSE is kept. The results are saved in sweep.csv, in the classifier configuration directory.")
+		("ann-sweep-learning-rate",
+			po::value< std::vector< Float > >(&(this->ann_sweep_learning_rates))->multitoken(),
+			"Learning rates of the neural networks to compare (see --ann-sweep-hidden-layers).")
 		("ann-validation-image",
 			po::value< std::vector< std::string > >(&(this->ann_validation_images))->multitoken(),
 			"The images to use to validate the training of the neural network (use --ann-validation-image-class to define associated classes). Multiple images can be specified. They mush have the same number of components per pixels than the images on which the neural network is trained.")
@@ -105,6 +183,15 @@ CliParser::ParseResult CliParser::parse_argv(int argc, char ** argv)
 		("ann-build-validation-from-training",
 			po::value< Percentage >(&(this->ann_validation_training_ratio))->default_value(Percentage(0.333f)),
 			"The percentage of elements from the training-set to extract to build the validation-set.")
+		("svm-c",
+			po::value< std::vector< Double > >(&(this->svm_c))->multitoken()->default_value(std::vector< Double >(1, 1.0), "1"),
+			"Values of the C parameter of the SVM. When several values of C or gamma are given, the best pair is selected by cross-validation.")
+		("svm-gamma",
+			po::value< std::vector< Double > >(&(this->svm_gamma))->multitoken(),
+			"Values of the gamma parameter of the RBF kernel of the SVM (default: 1 / (number of components per pixel + 1)).")
+		("svm-number-folds",
+			po::value< StrictlyPositiveInteger >(&(this->svm_number_folds))->default_value(5),
+			"Number of folds of the cross-validation used to select the parameters of the SVM.")
 		;
 
 	po::variables_map vm;
@@ -126,15 +213,36 @@ CliParser::ParseResult CliParser::parse_argv(int argc, char ** argv)
 	}
 
 	this->debug = vm.count("debug");
+	this->export_probability_maps = vm.count("export-probability-maps");
+	this->warm_start = vm.count("warm-start");
 
 	check_config_or_training_set(vm);
 
 	if( this->classifier_type == NONE )
 		throw CliException("You must specify the type of the classifier.");
-	else if( this->classifier_type == ANN )
+	else if( this->classifier_type == ANN ) {
 		check_ann_validation_set(vm);
+		check_ann_sweep(vm);
+	}
+	else if( this->classifier_type == SVM )
+		check_svm_parameters(vm);
+
+	if( this->warm_start ) {
+		if( this->classifier_config_dir.empty() )
+			throw CliException("The warm start requires the classifier configuration directory.");
+
+		if( this->classifier_training_images_classes.empty() )
+			throw CliException("The warm start requires a training-set.");
+	}
+
+	if( this->ann_checkpoint_interval > 0 && this->classifier_config_dir.empty() )
+		throw CliException("The checkpoints of the neural networks are saved in the classifier configuration directory, which is not specified.");
 
-	if( !this->input_image.empty() ) {
+	if( !this->daemon_socket.empty() ) {
+		check_daemon(vm);
+	} else if( !this->batch_manifest.empty() ) {
+		check_batch_manifest(vm);
+	} else if( !this->input_image.empty() ) {
 		check_regularization_parameters(vm);
 	} else {
 		if(this->classifier_config_dir.empty()) {
@@ -144,8 +252,10 @@ CliParser::ParseResult CliParser::parse_argv(int argc, char ** argv)
 
 	if( this->classifier_type == ANN )
 		print_ann_parameters();
+	else if( this->classifier_type == SVM && !this->classifier_training_images_classes.empty() )
+		print_svm_parameters();
 
-	if( !this->input_image.empty() )
+	if( !this->input_image.empty() || !this->batch_manifest.empty() || !this->daemon_socket.empty() )
 		print_regularization_parameters();
 
 	return CONTINUE;
@@ -156,6 +266,16 @@ const bool CliParser::get_debug() const
 	return this->debug;
 }
 
+const bool CliParser::get_export_probability_maps() const
+{
+	return this->export_probability_maps;
+}
+
+const bool CliParser::get_warm_start() const
+{
+	return this->warm_start;
+}
+
 const std::string CliParser::get_input_image() const
 {
 	return this->input_image;
@@ -166,6 +286,21 @@ const std::string CliParser::get_export_dir() const
 	return this->export_dir;
 }
 
+const std::string CliParser::get_batch_manifest() const
+{
+	return this->batch_manifest;
+}
+
+const std::string CliParser::get_daemon_socket() const
+{
+	return this->daemon_socket;
+}
+
+const unsigned int CliParser::get_daemon_workers() const
+{
+	return this->daemon_workers;
+}
+
 const std::string CliParser::get_region_of_interest() const
 {
 	return this->region_of_interest;
@@ -195,6 +330,26 @@ const std::string CliParser::get_classifier_config_dir() const
 	return this->classifier_config_dir;
 }
 
+const unsigned int CliParser::get_classifier_max_samples_per_class() const
+{
+	return this->classifier_max_samples_per_class;
+}
+
+const unsigned int CliParser::get_random_seed() const
+{
+	return this->random_seed;
+}
+
+const std::string CliParser::get_training_cache_dir() const
+{
+	return this->training_cache_dir;
+}
+
+const CliParser::FeatureScaling CliParser::get_feature_scaling() const
+{
+	return this->feature_scaling;
+}
+
 const std::vector<std::string> CliParser::get_classifier_training_images() const
 {
 	return this->classifier_training_images;
@@ -221,6 +376,44 @@ const float CliParser::get_ann_mse_target() const {
 	return this->ann_mse_target;
 }
 
+const CliParser::AnnTrainer CliParser::get_ann_trainer() const {
+	return this->ann_trainer;
+}
+
+const unsigned int CliParser::get_ann_batch_size() const {
+	return this->ann_batch_size;
+}
+
+const unsigned int CliParser::get_ann_patience() const {
+	return this->ann_patience;
+}
+
+const float CliParser::get_ann_min_improvement() const {
+	return this->ann_min_improvement;
+}
+
+const unsigned int CliParser::get_ann_checkpoint_interval() const {
+	return this->ann_checkpoint_interval;
+}
+
+const bool CliParser::get_ann_sweep() const {
+	return !this->ann_sweep_hidden_layers.empty() || !this->ann_sweep_learning_rates.empty();
+}
+
+const std::vector< std::vector< unsigned int > > CliParser::get_ann_sweep_hidden_layers() const {
+	if(this->ann_sweep_hidden_layers.empty())
+		return std::vector< std::vector< unsigned int > >(1, get_ann_hidden_layers());
+
+	return this->ann_sweep_hidden_layers;
+}
+
+const std::vector< float > CliParser::get_ann_sweep_learning_rates() const {
+	if(this->ann_sweep_learning_rates.empty())
+		return std::vector< float >(1, this->ann_learning_rate);
+
+	return std::vector< float >(this->ann_sweep_learning_rates.begin(), this->ann_sweep_learning_rates.end());
+}
+
 const std::vector<std::string> CliParser::get_ann_validation_images() const
 {
 	return this->ann_validation_images;
@@ -235,6 +428,18 @@ const float CliParser::get_ann_validation_training_ratio() const {
 	return this->ann_validation_training_ratio;
 }
 
+const std::vector< double > CliParser::get_svm_c() const {
+	return std::vector< double >(this->svm_c.begin(), this->svm_c.end());
+}
+
+const std::vector< double > CliParser::get_svm_gamma() const {
+	return std::vector< double >(this->svm_gamma.begin(), this->svm_gamma.end());
+}
+
+const unsigned int CliParser::get_svm_number_folds() const {
+	return this->svm_number_folds;
+}
+
 /*
  * If there is no image classes, the classifier must be loaded from a stored configuration (no training will be performed):
  *     Throw an exception if no directory for the sorted configuration is provided.
@@ -325,11 +530,66 @@ void CliParser::check_ann_validation_set(po::variables_map &vm) {
 	}
 }
 
+void CliParser::check_svm_parameters(po::variables_map &vm) {
+	for(std::vector< Double >::const_iterator it = this->svm_c.begin(); it != this->svm_c.end(); ++it)
+		if(*it <= 0)
+			throw CliException("The values of C must be strictly positive.");
+
+	for(std::vector< Double >::const_iterator it = this->svm_gamma.begin(); it != this->svm_gamma.end(); ++it)
+		if(*it <= 0)
+			throw CliException("The values of gamma must be strictly positive.");
+
+	if(this->svm_c.size() * std::max< size_t >(this->svm_gamma.size(), 1) > 1 && this->svm_number_folds < 2)
+		throw CliException("The cross-validation of the SVM requires at least 2 folds.");
+}
+
+void CliParser::check_ann_sweep(po::variables_map &vm) {
+	this->ann_sweep_hidden_layers.clear();
+
+	for(std::vector< std::string >::const_iterator it = this->ann_sweep_hidden_layers_args.begin(); it != this->ann_sweep_hidden_layers_args.end(); ++it) {
+		std::vector< std::string > tokens;
+		boost::algorithm::split(tokens, *it, boost::algorithm::is_any_of(","));
+
+		std::vector< unsigned int > layers;
+		for(std::vector< std::string >::const_iterator token = tokens.begin(); token != tokens.end(); ++token) {
+			unsigned int size;
+			if(!ParseUtils::ParseUInt(size, token->c_str(), 10) || size == 0)
+				throw CliException("Invalid hidden layers: " + *it);
+
+			layers.push_back(size);
+		}
+
+		this->ann_sweep_hidden_layers.push_back(layers);
+	}
+
+	if(!get_ann_sweep())
+		return;
+
+	if(this->ann_validation_images.empty() && this->ann_validation_training_ratio <= 0)
+		throw CliException("The neural networks of a sweep are compared on a validation-set, which is not specified.");
+
+	if(this->ann_checkpoint_interval > 0)
+		throw CliException("The checkpoints of the neural networks are not supported by the sweep.");
+
+	if(this->warm_start)
+		throw CliException("The sweep cannot start from an existing classifier.");
+}
+
 void CliParser::check_regularization_parameters(po::variables_map &vm) {
 	if(this->export_dir.empty())
 		throw CliException("You need to provide an export directory.");
 }
 
+void CliParser::check_batch_manifest(po::variables_map &vm) {
+	if(!this->input_image.empty() || !this->region_of_interest.empty() || !this->export_dir.empty())
+		throw CliException("The input images, regions of interest and export directories of a batch are given by the manifest, --input-image, --roi and --export-dir cannot be used.");
+}
+
+void CliParser::check_daemon(po::variables_map &vm) {
+	if(!this->input_image.empty() || !this->region_of_interest.empty() || !this->export_dir.empty() || !this->batch_manifest.empty())
+		throw CliException("The images segmented by the daemon are given on its socket, --input-image, --roi, --export-dir and --batch-manifest cannot be used.");
+}
+
 void CliParser::print_classifier_parameters() {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
@@ -363,20 +623,65 @@ void CliParser::print_ann_parameters() {
 	m << this->ann_hidden_layers;
 
 	LOG4CXX_INFO(logger, "Neural networks parameters:");
-	LOG4CXX_INFO(logger, "\tNumber of hidden neurons per layer: " << m.str());
-	LOG4CXX_INFO(logger, "\tLearning rate: " << this->ann_learning_rate);
+	if(get_ann_sweep()) {
+		const std::vector< std::vector< unsigned int > > hidden_layers = get_ann_sweep_hidden_layers();
+		for(std::vector< std::vector< unsigned int > >::const_iterator it = hidden_layers.begin(); it != hidden_layers.end(); ++it) {
+			std::stringstream l;
+			l << *it;
+			LOG4CXX_INFO(logger, "\tNumber of hidden neurons per layer (sweep): " << l.str());
+		}
+
+		std::stringstream r;
+		r << get_ann_sweep_learning_rates();
+		LOG4CXX_INFO(logger, "\tLearning rates (sweep): " << r.str());
+	} else {
+		LOG4CXX_INFO(logger, "\tNumber of hidden neurons per layer: " << m.str());
+		LOG4CXX_INFO(logger, "\tLearning rate: " << this->ann_learning_rate);
+	}
 	LOG4CXX_INFO(logger, "\tMaximum number of iterations: " << this->ann_max_epoch.value);
 	LOG4CXX_INFO(logger, "\tMean squared error targeted: " << this->ann_mse_target);
+	if(this->ann_trainer == MINIBATCH_TRAINER)
+		LOG4CXX_INFO(logger, "\tTrainer: minibatch gradient descent, " << this->ann_batch_size.value << " pixels per minibatch");
+	else
+		LOG4CXX_INFO(logger, "\tTrainer: FANN");
+	if(this->ann_patience > 0)
+		LOG4CXX_INFO(logger, "\tEarly stopping: patience of " << this->ann_patience << " epochs, minimum improvement of " << this->ann_min_improvement);
+	if(this->ann_checkpoint_interval > 0)
+		LOG4CXX_INFO(logger, "\tCheckpoint interval: " << this->ann_checkpoint_interval);
+}
+
+void CliParser::print_svm_parameters() {
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	std::stringstream c, gamma;
+	c << this->svm_c;
+	gamma << this->svm_gamma;
+
+	LOG4CXX_INFO(logger, "SVM parameters:");
+	LOG4CXX_INFO(logger, "\tC: " << c.str());
+	if(this->svm_gamma.empty())
+		LOG4CXX_INFO(logger, "\tGamma: 1 / (number of components per pixel + 1)");
+	else
+		LOG4CXX_INFO(logger, "\tGamma: " << gamma.str());
+	LOG4CXX_INFO(logger, "\tNumber of folds of the cross-validation: " << this->svm_number_folds.value);
 }
 
 void CliParser::print_regularization_parameters() {
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
 	LOG4CXX_INFO(logger, "Regularization parameters:");
-	LOG4CXX_INFO(logger,    "\tInput image: "          << this->input_image);
-	LOG4CXX_INFO(logger,    "\tExport directory: "     << this->export_dir);
-	LOG4CXX_INFO(logger,    "\tRegion of interest: "   << this->region_of_interest);
+	if(!this->daemon_socket.empty()) {
+		LOG4CXX_INFO(logger,    "\tDaemon socket: "        << this->daemon_socket);
+		LOG4CXX_INFO(logger,    "\tDaemon workers: "       << this->daemon_workers.value);
+	} else if(this->batch_manifest.empty()) {
+		LOG4CXX_INFO(logger,    "\tInput image: "          << this->input_image);
+		LOG4CXX_INFO(logger,    "\tExport directory: "     << this->export_dir);
+		LOG4CXX_INFO(logger,    "\tRegion of interest: "   << this->region_of_interest);
+	} else {
+		LOG4CXX_INFO(logger,    "\tBatch manifest: "       << this->batch_manifest);
+	}
 	LOG4CXX_INFO(logger,    "\tExport interval: "      << this->export_interval);
+	LOG4CXX_INFO(logger,    "\tExport probability maps: " << (this->export_probability_maps ? "yes" : "no"));
 	LOG4CXX_INFO(logger,    "\tNumber of iterations: " << this->num_iter);
 	LOG4CXX_INFO(logger,    "\tLambda1: "              << this->lambda);
 }
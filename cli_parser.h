@@ -32,6 +32,17 @@ public:
 		SVM
 	};
 
+	enum FeatureScaling {
+		NO_SCALING = 0,
+		STANDARD_SCALING,
+		MINMAX_SCALING
+	};
+
+	enum AnnTrainer {
+		FANN_TRAINER = 0,
+		MINIBATCH_TRAINER
+	};
+
 	CliParser();
 
 	/**
@@ -44,10 +55,15 @@ public:
 	ParseResult parse_argv(int argc, char ** argv);
 
 	const bool get_debug() const;
+	const bool get_export_probability_maps() const;
+	const bool get_warm_start() const;
 
 	const std::string get_input_image() const;
 	const std::string get_region_of_interest() const;
 	const std::string get_export_dir() const;
+	const std::string get_batch_manifest() const;
+	const std::string get_daemon_socket() const;
+	const unsigned int get_daemon_workers() const;
 	const int         get_export_interval() const;
 	const int         get_num_iter() const;
 	const double      get_lambda() const;
@@ -57,23 +73,44 @@ public:
 	const std::vector< std::string >  get_classifier_training_images() const;
 	const std::vector< std::string >  get_classifier_training_images_classes() const;
 	const std::string                 get_classifier_config_dir() const;
+	const unsigned int                get_classifier_max_samples_per_class() const;
+	const unsigned int                get_random_seed() const;
+	const std::string                 get_training_cache_dir() const;
+	const FeatureScaling              get_feature_scaling() const;
 
 	const std::vector< unsigned int > get_ann_hidden_layers() const;
 	const float                       get_ann_learning_rate() const;
 	const unsigned int                get_ann_max_epoch() const;
 	const float                       get_ann_mse_target() const;
+	const AnnTrainer                  get_ann_trainer() const;
+	const unsigned int                get_ann_batch_size() const;
+	const unsigned int                get_ann_patience() const;
+	const float                       get_ann_min_improvement() const;
+	const unsigned int                get_ann_checkpoint_interval() const;
+	const bool                        get_ann_sweep() const;
+	const std::vector< std::vector< unsigned int > > get_ann_sweep_hidden_layers() const;
+	const std::vector< float >        get_ann_sweep_learning_rates() const;
 	const std::vector< std::string >  get_ann_validation_images() const;
 	const std::vector< std::string >  get_ann_validation_images_classes() const;
 	const float                       get_ann_validation_training_ratio() const;
 
+	const std::vector< double >       get_svm_c() const;
+	const std::vector< double >       get_svm_gamma() const;
+	const unsigned int                get_svm_number_folds() const;
+
 private:
 	typedef std::vector< StrictlyPositiveInteger > HiddenLayerVector;
 
 	bool debug;
+	bool export_probability_maps;
+	bool warm_start;
 
 	std::string     input_image;
 	std::string     region_of_interest;
 	std::string     export_dir;
+	std::string     batch_manifest;
+	std::string     daemon_socket;
+	StrictlyPositiveInteger daemon_workers;
 	PositiveInteger export_interval;
 	PositiveInteger num_iter;
 	Double          lambda;
@@ -82,23 +119,42 @@ private:
 	std::vector< std::string > classifier_training_images;
 	std::vector< std::string > classifier_training_images_classes;
 	std::string                classifier_config_dir;
+	PositiveInteger            classifier_max_samples_per_class;
+	PositiveInteger            random_seed;
+	std::string                training_cache_dir;
+	FeatureScaling             feature_scaling;
 
 	HiddenLayerVector           ann_hidden_layers;
 	Float                       ann_learning_rate;
 	StrictlyPositiveInteger     ann_max_epoch;
 	Float                       ann_mse_target;
+	AnnTrainer                  ann_trainer;
+	StrictlyPositiveInteger     ann_batch_size;
+	PositiveInteger             ann_patience;
+	Float                       ann_min_improvement;
+	PositiveInteger             ann_checkpoint_interval;
+	std::vector< std::string >  ann_sweep_hidden_layers_args;
+	std::vector< std::vector< unsigned int > > ann_sweep_hidden_layers;
+	std::vector< Float >        ann_sweep_learning_rates;
 	std::vector< std::string >  ann_validation_images;
 	std::vector< std::string >  ann_validation_images_classes;
 	Percentage                  ann_validation_training_ratio;
 
+	std::vector< Double >       svm_c;
+	std::vector< Double >       svm_gamma;
 	StrictlyPositiveInteger     svm_number_folds;
 
 	void check_config_or_training_set(po::variables_map &vm);
 	void check_ann_validation_set(po::variables_map &vm);
+	void check_ann_sweep(po::variables_map &vm);
+	void check_svm_parameters(po::variables_map &vm);
 	void check_regularization_parameters(po::variables_map &vm);
+	void check_batch_manifest(po::variables_map &vm);
+	void check_daemon(po::variables_map &vm);
 
 	void print_classifier_parameters();
 	void print_ann_parameters();
+	void print_svm_parameters();
 	void print_regularization_parameters();
 };
 
@@ -1,17 +1,111 @@
 #include "image_loader.h"
 
 #include "itkImageFileReader.h"
-#include "itkImageSeriesReader.h"
 
 #include <ostream>
 
 #include <boost/filesystem.hpp>
-#include <boost/regex.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <algorithm>
+#include <vector>
 
 #include "log4cxx/logger.h"
 
+#include "MetaImageHeader.h"
+#include "MappedFile.h"
+
 typedef itk::ImageFileReader< ImageType > ImageReader;
-typedef itk::ImageSeriesReader< ImageType > ImageSeriesReader;
+typedef itk::ImageFileReader< ImageLoader::SliceType > SliceReader;
+typedef itk::ImageFileReader< FeaturesImage > FeaturesReader;
+
+namespace {
+
+/**
+ * \class MappedPixelContainer
+ *
+ * \brief A pixel container whose buffer is (a part of) a mapped file.
+ * The mapping lives as long as the container.
+ */
+class MappedPixelContainer : public FeaturesImage::PixelContainer
+{
+public:
+	typedef MappedPixelContainer          Self;
+	typedef FeaturesImage::PixelContainer Superclass;
+	typedef itk::SmartPointer< Self >     Pointer;
+	typedef itk::SmartPointer< const Self > ConstPointer;
+
+	itkNewMacro(Self);
+	itkTypeMacro(MappedPixelContainer, ImportImageContainer);
+
+	void SetMapping(boost::shared_ptr< MappedFile > mapping, const size_t offset, const itk::SizeValueType size)
+	{
+		m_Mapping = mapping;
+		this->SetImportPointer(reinterpret_cast< FeaturesImage::InternalPixelType* >(mapping->data() + offset), size, false);
+	}
+
+protected:
+	MappedPixelContainer() {}
+	~MappedPixelContainer() {}
+
+private:
+	boost::shared_ptr< MappedFile > m_Mapping;
+};
+
+/**
+ * Copies a region of the buffer of an image, row by row, in a buffer of the size of the region.
+ */
+template <typename TImage>
+void copy_region(const TImage *image, const typename TImage::RegionType &region, typename TImage::InternalPixelType *destination, const size_t components)
+{
+	const typename TImage::InternalPixelType *source = image->GetBufferPointer();
+	const typename TImage::SizeType size = region.GetSize();
+	const size_t row_length = size[0] * components;
+	const long number_of_rows = size[1] * size[2];
+
+	#pragma omp parallel for schedule(static)
+	for(long r = 0; r < number_of_rows; ++r)
+	{
+		typename TImage::IndexType index = region.GetIndex();
+		index[1] += r % size[1];
+		index[2] += r / size[1];
+
+		const typename TImage::InternalPixelType *row = source + image->ComputeOffset(index) * components;
+		std::copy(row, row + row_length, destination + r * row_length);
+	}
+}
+
+template <typename TImage>
+typename TImage::Pointer create_cropped_image(const TImage *image, const typename TImage::RegionType &region)
+{
+	if(!image->GetBufferedRegion().IsInside(region)) {
+		std::stringstream err;
+		err << "The region " << region << " is not inside the buffered region of the image " << image->GetBufferedRegion();
+		throw ImageLoadingException(err.str());
+	}
+
+	typename TImage::IndexType start;
+	start.Fill(0);
+
+	typename TImage::PointType origin;
+	for(unsigned int d = 0; d < TImage::ImageDimension; ++d)
+		origin[d] = image->GetOrigin()[d] + region.GetIndex()[d] * image->GetSpacing()[d];
+
+	typename TImage::Pointer cropped = TImage::New();
+	cropped->SetRegions(typename TImage::RegionType(start, region.GetSize()));
+	cropped->SetSpacing(image->GetSpacing());
+	cropped->SetOrigin(origin);
+
+	return cropped;
+}
+
+bool is_big_endian()
+{
+	const unsigned int one = 1;
+	return *reinterpret_cast< const unsigned char* >(&one) == 0;
+}
+
+}
 
 ImageType::Pointer ImageLoader::load(const std::string filename)
 {
@@ -77,26 +171,23 @@ ImageType::Pointer ImageLoader::loadImage(const std::string filename)
 
 ImageType::Pointer ImageLoader::loadImageSerie(const std::string filename)
 {
-	typename ImageSeriesReader::Pointer reader = ImageSeriesReader::New();
-
-	typename ImageSeriesReader::FileNamesContainer filenames;
+	std::vector< std::string > filenames;
 
 	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
 
 	try
 	{
-		boost::filesystem::path path(filename);
+		// The directory is made absolute once, so are the paths of its entries.
+		boost::filesystem::path path = boost::filesystem::absolute(filename);
 		boost::filesystem::directory_iterator end_iter;
-		boost::regex pattern(".*\\.((?:png)|(?:bmp)|(?:jpe?g))", boost::regex::icase);
 
 		for( boost::filesystem::directory_iterator dir_iter(path) ; dir_iter != end_iter ; ++dir_iter)
 		{
-			boost::smatch match;
-			if( !boost::regex_match( dir_iter->path().filename().string(), match, pattern ) ) continue;
+			const std::string extension = boost::algorithm::to_lower_copy(dir_iter->path().extension().string());
 
-			LOG4CXX_DEBUG(logger, "Loading \"" << boost::filesystem::absolute(dir_iter->path()).string() << "\"");
+			if( extension != ".png" && extension != ".bmp" && extension != ".jpg" && extension != ".jpeg" ) continue;
 
-			filenames.push_back(boost::filesystem::absolute(dir_iter->path()).string());
+			filenames.push_back(dir_iter->path().string());
 		}
 	}
 	catch(boost::filesystem::filesystem_error &ex) {
@@ -106,9 +197,198 @@ ImageType::Pointer ImageLoader::loadImageSerie(const std::string filename)
 		throw ImageLoadingException(err.str());
 	}
 
+	if(filenames.empty()) {
+		std::stringstream err;
+		err << "\"" << filename << "\" does not contain any image";
+
+		throw ImageLoadingException(err.str());
+	}
+
 	std::sort(filenames.begin(), filenames.end());
 
-	reader->SetFileNames(filenames);
+	LOG4CXX_DEBUG(logger, "Loading " << filenames.size() << " slices from \"" << filename << "\"");
+
+	/*
+	 * The first slice gives the geometry of the volume. The other slices are decoded
+	 * concurrently, each one directly in its place in the buffer of the volume.
+	 */
+	SliceType::Pointer first_slice = loadSlice(filenames.front());
+
+	const SliceType::SizeType slice_size = first_slice->GetLargestPossibleRegion().GetSize();
+	const size_t slice_length = slice_size[0] * slice_size[1];
+
+	ImageType::SizeType size;
+	size[0] = slice_size[0];
+	size[1] = slice_size[1];
+	size[2] = filenames.size();
+
+	ImageType::IndexType start;
+	start.Fill(0);
+
+	ImageType::SpacingType spacing;
+	spacing[0] = first_slice->GetSpacing()[0];
+	spacing[1] = first_slice->GetSpacing()[1];
+	spacing[2] = 1.0;
+
+	ImageType::PointType origin;
+	origin[0] = first_slice->GetOrigin()[0];
+	origin[1] = first_slice->GetOrigin()[1];
+	origin[2] = 0.0;
+
+	ImageType::Pointer img = ImageType::New();
+	img->SetRegions(ImageType::RegionType(start, size));
+	img->SetSpacing(spacing);
+	img->SetOrigin(origin);
+	img->Allocate();
+
+	ImageType::PixelType *buffer = img->GetBufferPointer();
+	std::copy(first_slice->GetBufferPointer(), first_slice->GetBufferPointer() + slice_length, buffer);
+	first_slice = NULL;
+
+	const int number_of_slices = filenames.size();
+	std::vector< std::string > errors(number_of_slices);
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int i = 1; i < number_of_slices; ++i)
+	{
+		try {
+			SliceType::Pointer slice = loadSlice(filenames[i]);
+
+			if(slice->GetLargestPossibleRegion().GetSize() != slice_size) {
+				std::stringstream err;
+				err << "The dimensions of \"" << filenames[i] << "\" (" << slice->GetLargestPossibleRegion().GetSize()
+				    << ") differs from the dimensions of the first slice (" << slice_size << ")";
+				errors[i] = err.str();
+				continue;
+			}
+
+			std::copy(slice->GetBufferPointer(), slice->GetBufferPointer() + slice_length, buffer + i * slice_length);
+		} catch (ImageLoadingException &ex) {
+			errors[i] = ex.what();
+		}
+	}
+
+	for(int i = 1; i < number_of_slices; ++i) {
+		if(!errors[i].empty()) {
+			std::stringstream err;
+			err << "Unable to load the image serie located in \"" << filename << "\" (" << errors[i] << ")";
+
+			throw ImageLoadingException(err.str());
+		}
+	}
+
+	return img;
+}
+
+ImageLoader::SliceType::Pointer ImageLoader::loadSlice(const std::string filename)
+{
+	typename SliceReader::Pointer reader = SliceReader::New();
+
+	reader->SetFileName(filename);
+
+	try {
+		reader->Update();
+	}
+	catch( itk::ExceptionObject &ex )
+	{
+		std::stringstream err;
+		err << "ITK is unable to load the image \"" << filename << "\" (" << ex.what() << ")";
+
+		throw ImageLoadingException(err.str());
+	}
+
+	return reader->GetOutput();
+}
+
+FeaturesImage::Pointer ImageLoader::loadFeatures(const std::string filename)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	FeaturesImage::Pointer image = mapFeatures(filename);
+
+	if(image.IsNull()) {
+		image = readFeatures(filename);
+	} else {
+		LOG4CXX_DEBUG(logger, "\"" << filename << "\" is mapped in memory");
+	}
+
+	return image;
+}
+
+FeaturesImage::Pointer ImageLoader::mapFeatures(const std::string filename)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	const boost::filesystem::path path(filename);
+	const std::string extension = boost::algorithm::to_lower_copy(path.extension().string());
+
+	if(extension != ".mha" && extension != ".mhd")
+		return NULL;
+
+	MetaImageHeader header;
+	try {
+		header = MetaImageHeader::read(filename);
+	} catch (MetaImageException &ex) {
+		LOG4CXX_DEBUG(logger, ex.what());
+		return NULL;
+	}
+
+	// Only the layout of the buffer of a FeaturesImage can be mapped as is.
+	if( header.element_type != "MET_FLOAT" || header.compressed || header.msb != is_big_endian() ||
+	    header.dim_size.size() < 2 || header.dim_size.size() > __ImageDimension ||
+	    header.element_data_file == "LIST" || header.element_data_file.find('%') != std::string::npos )
+		return NULL;
+
+	FeaturesImage::SizeType size;
+	FeaturesImage::SpacingType spacing;
+	FeaturesImage::PointType origin;
+	for(unsigned int d = 0; d < __ImageDimension; ++d) {
+		size[d]    = d < header.dim_size.size()        ? header.dim_size[d]        : 1;
+		spacing[d] = d < header.element_spacing.size() ? header.element_spacing[d] : 1.0;
+		origin[d]  = d < header.offset.size()          ? header.offset[d]          : 0.0;
+	}
+
+	boost::shared_ptr< MappedFile > mapping;
+	size_t offset;
+
+	try {
+		if(header.element_data_file == "LOCAL") {
+			mapping = MappedFile::open(filename);
+			offset = header.local_data_offset;
+		} else {
+			mapping = MappedFile::open((path.parent_path() / header.element_data_file).native());
+			offset = header.header_size >= 0 ? header.header_size : mapping->size() - header.getDataSize();
+		}
+	} catch (MappedFileException &ex) {
+		LOG4CXX_DEBUG(logger, ex.what());
+		return NULL;
+	}
+
+	if( (mapping->size() < header.getDataSize()) || (offset > mapping->size() - header.getDataSize()) ||
+	    (offset % sizeof(FeaturesImage::InternalPixelType) != 0) )
+		return NULL;
+
+	FeaturesImage::IndexType start;
+	start.Fill(0);
+
+	MappedPixelContainer::Pointer container = MappedPixelContainer::New();
+	container->SetMapping(mapping, offset, header.getDataSize() / sizeof(FeaturesImage::InternalPixelType));
+
+	FeaturesImage::Pointer image = FeaturesImage::New();
+	image->SetRegions(FeaturesImage::RegionType(start, size));
+	image->SetSpacing(spacing);
+	image->SetOrigin(origin);
+	image->SetNumberOfComponentsPerPixel(header.number_of_channels);
+	image->SetPixelContainer(container);
+
+	return image;
+}
+
+FeaturesImage::Pointer ImageLoader::readFeatures(const std::string filename)
+{
+	typename FeaturesReader::Pointer reader = FeaturesReader::New();
+
+	reader->SetFileName(filename);
 
 	try {
 		reader->Update();
@@ -116,7 +396,7 @@ ImageType::Pointer ImageLoader::loadImageSerie(const std::string filename)
 	catch( itk::ExceptionObject &ex )
 	{
 		std::stringstream err;
-		err << "ITK is unable to load the image serie located in \"" << filename << "\" (" << ex.what() << ")";
+		err << "ITK is unable to load the image \"" << filename << "\" (" << ex.what() << ")";
 
 		throw ImageLoadingException(err.str());
 	}
@@ -124,3 +404,72 @@ ImageType::Pointer ImageLoader::loadImageSerie(const std::string filename)
 	return reader->GetOutput();
 }
 
+FeaturesImage::Pointer ImageLoader::loadFeatures(const std::string filename, const FeaturesImage::RegionType &region)
+{
+	// Only the pages of the region will be read from a mapped file.
+	FeaturesImage::Pointer image = mapFeatures(filename);
+
+	if(image.IsNull()) {
+		typename FeaturesReader::Pointer reader = FeaturesReader::New();
+
+		reader->SetFileName(filename);
+
+		try {
+			reader->UpdateOutputInformation();
+			reader->GetOutput()->SetRequestedRegion(region);
+			reader->Update();
+		}
+		catch( itk::ExceptionObject &ex )
+		{
+			std::stringstream err;
+			err << "ITK is unable to load the image \"" << filename << "\" (" << ex.what() << ")";
+
+			throw ImageLoadingException(err.str());
+		}
+
+		image = reader->GetOutput();
+	}
+
+	return crop(image, region);
+}
+
+FeaturesImage::Pointer ImageLoader::loadFeaturesInformation(const std::string filename)
+{
+	typename FeaturesReader::Pointer reader = FeaturesReader::New();
+
+	reader->SetFileName(filename);
+
+	try {
+		reader->UpdateOutputInformation();
+	}
+	catch( itk::ExceptionObject &ex )
+	{
+		std::stringstream err;
+		err << "ITK is unable to read the header of the image \"" << filename << "\" (" << ex.what() << ")";
+
+		throw ImageLoadingException(err.str());
+	}
+
+	return reader->GetOutput();
+}
+
+ImageType::Pointer ImageLoader::crop(ImageType::Pointer image, const ImageType::RegionType &region)
+{
+	ImageType::Pointer cropped = create_cropped_image< ImageType >(image, region);
+	cropped->Allocate();
+
+	copy_region< ImageType >(image, region, cropped->GetBufferPointer(), 1);
+
+	return cropped;
+}
+
+FeaturesImage::Pointer ImageLoader::crop(FeaturesImage::Pointer image, const FeaturesImage::RegionType &region)
+{
+	FeaturesImage::Pointer cropped = create_cropped_image< FeaturesImage >(image, region);
+	cropped->SetNumberOfComponentsPerPixel(image->GetNumberOfComponentsPerPixel());
+	cropped->Allocate();
+
+	copy_region< FeaturesImage >(image, region, cropped->GetBufferPointer(), image->GetNumberOfComponentsPerPixel());
+
+	return cropped;
+}
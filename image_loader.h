@@ -15,12 +15,44 @@ public:
 class ImageLoader
 {
 public:
+  typedef itk::Image< ImageType::PixelType, 2 > SliceType;
+
   /**
    * Load an image either as a single file or as a serie of files.
    * @param[in] filename The file to load of the folder containing the files. Must exists.
    */
   static ImageType::Pointer load(const std::string filename);
 
+  /**
+   * Load a features image. Uncompressed MetaImage files storing floats are mapped
+   * in memory instead of being read, other files are read by ITK.
+   * @param[in] filename The file to load. Must exists.
+   */
+  static FeaturesImage::Pointer loadFeatures(const std::string filename);
+
+  /**
+   * Load a region of a features image. Only this region is read when the file can be
+   * streamed by ITK, or touched when the file is mapped.
+   * @param[in] filename The file to load. Must exists.
+   * @param[in] region The region to load.
+   * @return An image of the size of the region, with a start index of 0.
+   */
+  static FeaturesImage::Pointer loadFeatures(const std::string filename, const FeaturesImage::RegionType &region);
+
+  /**
+   * Read the header of a features image (size, spacing, origin, number of components).
+   * The returned image has no buffer.
+   * @param[in] filename The file to read. Must exists.
+   */
+  static FeaturesImage::Pointer loadFeaturesInformation(const std::string filename);
+
+  /**
+   * Copy a region of an image.
+   * @return An image of the size of the region, with a start index of 0.
+   */
+  static ImageType::Pointer crop(ImageType::Pointer image, const ImageType::RegionType &region);
+  static FeaturesImage::Pointer crop(FeaturesImage::Pointer image, const FeaturesImage::RegionType &region);
+
 private:
   /**
    * Load an image as a single file.
@@ -34,6 +66,26 @@ private:
    */
   static ImageType::Pointer loadImageSerie(const std::string filename);
 
+  /**
+   * Load a single slice of a serie.
+   * @param[in] filename The file to load. Must exists.
+   */
+  static SliceType::Pointer loadSlice(const std::string filename);
+
+  /**
+   * Map a MetaImage features image in memory. The file is not copied, the buffer
+   * of the image is the mapping of the file.
+   * @param[in] filename The .mha or .mhd file to map.
+   * @return The image, or a null pointer if the file cannot be mapped.
+   */
+  static FeaturesImage::Pointer mapFeatures(const std::string filename);
+
+  /**
+   * Read a features image with ITK.
+   * @param[in] filename The file to load. Must exists.
+   */
+  static FeaturesImage::Pointer readFeatures(const std::string filename);
+
 };
 
 #endif /* IMAGE_LOADER_H */
@@ -12,34 +12,27 @@
 #include "common.h"
 #include "time_utils.h"
 #include "cli_parser.h"
-#include "image_loader.h"
 #include "Classifier.h"
 #include "ClassificationDataset.h"
 #include "FannClassificationDataset.h"
 #include "NeuralNetworkPixelClassifiers.h"
+#include "MinibatchTrainer.h"
+#include "NeuralNetworkSweep.h"
 #include "LibSVMClassificationDataset.h"
 #include "SVMPixelClassifier.h"
+#include "TrainingSetCache.h"
+#include "segmentation.h"
+#include "segmentation_daemon.h"
 
 #include "doublefann.h"
 
 #include <tulip/TlpQtTools.h>
 #include <tulip/PluginLoaderTxt.h>
-#include <tulip/Graph.h>
 #include <tulip/TlpTools.h>
 #include <tulip/PluginLibraryLoader.h>
-#include <tulip/StringCollection.h>
-#include <tulip/DoubleProperty.h>
-#include <tulip/BooleanProperty.h>
 
 #include <boost/filesystem.hpp>
 
-#include <itkImageSeriesWriter.h>
-#include <itkNumericSeriesFileNames.h>
-
-#include <itkBinaryThresholdImageFilter.h>
-
-#include "LoggerPluginProgress.h"
-
 #include "log4cxx/logger.h"
 #include "log4cxx/consoleappender.h"
 #include "log4cxx/patternlayout.h"
@@ -52,54 +45,65 @@ using namespace std;
 
 namespace bfs = boost::filesystem;
 
-//bool desc_comparator(const T a, const T b) { return a > b; }
-template <typename T>
-class desc_comparator {
-public:
-	desc_comparator(std::vector<T> const & values) :m_values(values) {}
-	inline bool operator() (size_t a, size_t b) { return m_values[a] > m_values[b]; }
-private:
-	std::vector<T> const& m_values;
-};
-
-template <typename T>
-std::vector<size_t> ordered(std::vector<T> const& values, desc_comparator<T> comparator) {
-	std::vector<size_t> indices(values.size());
-	//std::iota(begin(indices), end(indices), static_cast<size_t>(0)); // cxx11
-	for (size_t i = 0; i != indices.size(); ++i) indices[i] = i;
-
-	std::sort( indices.begin(), indices.end(), comparator );
-
-	return indices;
+/**
+ * Returns the file of the training-set cache holding the dataset built from these
+ * images and masks, or an empty string if there is no cache.
+ */
+std::string get_cached_dataset_filename(const boost::shared_ptr< TrainingSetCache > cache,
+                                        const std::vector< std::string > &image_filenames,
+                                        const std::vector< std::string > &class_filenames,
+                                        const size_t max_samples_per_class,
+                                        const uint64_t seed)
+{
+	if(!cache)
+		return std::string();
+
+	try {
+		return cache->getFilename(image_filenames, class_filenames, max_samples_per_class, seed);
+	} catch (TrainingSetCacheException &ex) {
+		log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+		LOG4CXX_WARN(logger, "The training-set cache will not be used: " << ex.what());
+		return std::string();
+	}
 }
 
-class DirException : public std::runtime_error
+/**
+ * Loads a dataset from the training-set cache.
+ * Returns an empty pointer if the dataset is not cached.
+ */
+boost::shared_ptr< ClassificationDataset<double> > load_cached_dataset(const std::string &filename)
 {
-private:
-	DirException ( const std::string &err ) : std::runtime_error (err) {}
-public:
-	static DirException NotEmpty(const bfs::path &path) {     return DirException(path.native() + " is not empty."); }
-	static DirException File(const bfs::path &path) {         return DirException(path.native() + " is a file."); }
-	static DirException CannotCreate(const bfs::path &path) { return DirException(path.native() + " cannot be created."); }
-};
-
-void get_directory(const bfs::path &path, const bool mustBeEmpty = false) {
-	if(bfs::exists(path)) {
-		if(bfs::is_directory(path)) {
-			if(mustBeEmpty && !bfs::is_empty(path))
-				throw DirException::NotEmpty(path);
-		} else
-			throw DirException::File(path);
-	} else {
-		if(!bfs::create_directories(path))
-			throw DirException::CannotCreate(path);
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	if(filename.empty() || !bfs::exists(filename))
+		return boost::shared_ptr< ClassificationDataset<double> >();
+
+	try {
+		boost::shared_ptr< ClassificationDataset<double> > dataset = ClassificationDataset<double>::load(filename);
+		LOG4CXX_INFO(logger, "Dataset loaded from the training-set cache: " << filename);
+		return dataset;
+	} catch (ClassificationDatasetException &ex) {
+		LOG4CXX_WARN(logger, "Ignoring the cached dataset: " << ex.what());
+		return boost::shared_ptr< ClassificationDataset<double> >();
 	}
 }
 
-std::string pad(const unsigned int i, const char c = '0', const unsigned int l = 6) {
-	std::ostringstream os;
-	os << std::setfill(c) << std::setw(l) << i;
-	return os.str();
+/**
+ * Stores a dataset in the training-set cache (failures are not fatal).
+ */
+void cache_dataset(const ClassificationDataset<double> &dataset, const std::string &filename)
+{
+	if(filename.empty())
+		return;
+
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	try {
+		dataset.save(filename);
+		LOG4CXX_INFO(logger, "Dataset stored in the training-set cache: " << filename);
+	} catch (ClassificationDatasetException &ex) {
+		LOG4CXX_WARN(logger, "Cannot store the dataset in the training-set cache: " << ex.what());
+	}
 }
 
 int main(int argc, char **argv)
@@ -128,28 +132,30 @@ int main(int argc, char **argv)
 
 	timestamp_t last_timestamp;
 
-	FeaturesImage::Pointer input_image;
+	const bool train_on_input_image = !cli_parser.get_classifier_training_images_classes().empty() && cli_parser.get_classifier_training_images().empty();
+
+	// The image to segment (if any), and the image the classifier is trained on (if it is the input image).
+	SegmentationInput input;
+	FeaturesImage::Pointer training_input_image;
 
 	/*
 	 * Loading the input image (if it exists).
 	 */
 	if(!cli_parser.get_input_image().empty()) {
-		last_timestamp = get_timestamp();
-		LOG4CXX_INFO(logger, "Loading features image");
-
-		typename itk::ImageFileReader< FeaturesImage >::Pointer input_image_reader = itk::ImageFileReader< FeaturesImage >::New();
-		input_image_reader->SetFileName(cli_parser.get_input_image());
+		SegmentationJob job;
+		job.input_image = cli_parser.get_input_image();
+		job.region_of_interest = cli_parser.get_region_of_interest();
+		job.export_dir = cli_parser.get_export_dir();
 
 		try {
-			input_image_reader->Update();
-		} catch( itk::ExceptionObject &ex ) {
-			LOG4CXX_FATAL(logger, "ITK is unable to load the image \"" << cli_parser.get_input_image() << "\" (" << ex.what() << ")");
+			input = load_segmentation_input(job, train_on_input_image);
+		} catch (SegmentationException &ex) {
+			LOG4CXX_FATAL(logger, ex.what());
 			exit(-1);
 		}
 
-		input_image = input_image_reader->GetOutput();
-
-		LOG4CXX_INFO(logger, "Features image loaded in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
+		training_input_image = input.full_image;
+		input.full_image = NULL;
 	}
 
 	boost::shared_ptr< Classifier<fann_type> > pixelClassifier;
@@ -171,6 +177,9 @@ int main(int argc, char **argv)
 			exit(-1);
 		}
 	} else {
+		// The results of the comparison of neural networks (if any).
+		boost::shared_ptr< NeuralNetworkSweep > sweep;
+
 		/*
 		 * Loading the training classes.
 		 */
@@ -179,15 +188,37 @@ int main(int argc, char **argv)
 
 		boost::shared_ptr< ClassificationDataset<double> > trainingDataset;
 
+		boost::shared_ptr< TrainingSetCache > training_set_cache;
+		if(!cli_parser.get_training_cache_dir().empty()) {
+			try {
+				training_set_cache = boost::shared_ptr< TrainingSetCache >(new TrainingSetCache(cli_parser.get_training_cache_dir()));
+			} catch (TrainingSetCacheException &ex) {
+				LOG4CXX_WARN(logger, "The training-set cache will not be used: " << ex.what());
+			}
+		}
+
+		const std::string cached_training_dataset_filename = get_cached_dataset_filename(
+				training_set_cache,
+				train_on_input_image ? std::vector< std::string >(1, cli_parser.get_input_image()) : cli_parser.get_classifier_training_images(),
+				cli_parser.get_classifier_training_images_classes(),
+				cli_parser.get_classifier_max_samples_per_class(), cli_parser.get_random_seed());
+
 		try {
-			if(cli_parser.get_classifier_training_images().empty()) {
+			trainingDataset = load_cached_dataset(cached_training_dataset_filename);
+
+			const bool cached = (trainingDataset.get() != NULL);
+
+			if(cached) {
+				// Nothing to extract.
+			} else if(cli_parser.get_classifier_training_images().empty()) {
 				/*
 				 * No image provided for training the classifier, so we
 				 * wil use the one that will be segmented.
 				 */
 				LOG4CXX_INFO(logger, "Loading training classes from input image");
 
-				trainingDataset = boost::shared_ptr< ClassificationDataset<double> >(new ClassificationDataset<double>(input_image, cli_parser.get_classifier_training_images_classes()));
+				trainingDataset = boost::shared_ptr< ClassificationDataset<double> >(new ClassificationDataset<double>(training_input_image, cli_parser.get_classifier_training_images_classes(),
+						cli_parser.get_classifier_max_samples_per_class(), cli_parser.get_random_seed()));
 			} else {
 				/*
 				 * A list of image is available to train the classifier.
@@ -195,18 +226,93 @@ int main(int argc, char **argv)
 				LOG4CXX_INFO(logger, "Loading training classes from a list of images");
 
 				trainingDataset = boost::shared_ptr< ClassificationDataset<double> >(
-						new ClassificationDataset<double>(cli_parser.get_classifier_training_images(), cli_parser.get_classifier_training_images_classes())
+						new ClassificationDataset<double>(cli_parser.get_classifier_training_images(), cli_parser.get_classifier_training_images_classes(),
+						                                  cli_parser.get_classifier_max_samples_per_class(), cli_parser.get_random_seed())
 				);
 			}
 
 			trainingDataset->checkValid();
 
+			if(!cached)
+				cache_dataset(*trainingDataset, cached_training_dataset_filename);
+
+			training_input_image = NULL;
+
 			LOG4CXX_INFO(logger, "Training classes loaded in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
 		} catch (ClassificationDatasetException & ex) {
 			LOG4CXX_FATAL(logger, "Unable to load the training classes: " << ex.what());
 			exit(-1);
 		}
 
+		/*
+		 * The classifier the training starts from (warm start).
+		 */
+		boost::shared_ptr< Classifier<fann_type> > previousClassifier;
+
+		if(cli_parser.get_warm_start()) {
+			LOG4CXX_INFO(logger, "Loading the classifier to start the training from");
+
+			try {
+				if(cli_parser.get_classifier_type() == CliParser::ANN) {
+					previousClassifier = boost::shared_ptr< Classifier<fann_type> >(new NeuralNetworkPixelClassifiers);
+				} else if(cli_parser.get_classifier_type() == CliParser::SVM) {
+					previousClassifier = boost::shared_ptr< Classifier<fann_type> >(new SVMPixelClassifier);
+				}
+
+				previousClassifier->load(cli_parser.get_classifier_config_dir());
+			} catch (std::runtime_error &err) {
+				LOG4CXX_FATAL(logger, err.what());
+				exit(-1);
+			}
+
+			if(previousClassifier->getNumberOfClasses() != trainingDataset->getNumberOfClasses()) {
+				LOG4CXX_FATAL(logger, "The classifier to start the training from has " << previousClassifier->getNumberOfClasses() << " classes, "
+				                   << "but the training-set has " << trainingDataset->getNumberOfClasses() << " classes.");
+				exit(-1);
+			}
+		}
+
+		/*
+		 * Scaling of the features, computed on the whole training-set (before the
+		 * validation-set is extracted from it). When the training starts from a
+		 * classifier, its scaling is used, since it has been trained with it.
+		 */
+		boost::shared_ptr< FeatureScaler<double> > scaler;
+
+		if(previousClassifier) {
+			scaler = previousClassifier->getScaler();
+
+			if(cli_parser.get_feature_scaling() != CliParser::NO_SCALING && !scaler)
+				LOG4CXX_WARN(logger, "The classifier to start the training from does not scale the features, --feature-scaling is ignored");
+
+			if(scaler && scaler->getInputSize() != trainingDataset->getInputSize()) {
+				LOG4CXX_FATAL(logger, "The feature scaling of the classifier to start the training from does not match the training-set.");
+				exit(-1);
+			}
+		} else if(cli_parser.get_feature_scaling() != CliParser::NO_SCALING) {
+			try {
+				scaler = trainingDataset->computeScaler(cli_parser.get_feature_scaling() == CliParser::STANDARD_SCALING
+				                                        ? FeatureScaler<double>::STANDARD : FeatureScaler<double>::MINMAX);
+			} catch (ClassificationDatasetException & ex) {
+				LOG4CXX_FATAL(logger, "Unable to scale the features: " << ex.what());
+				exit(-1);
+			}
+		}
+
+		if(scaler) {
+			last_timestamp = get_timestamp();
+			LOG4CXX_INFO(logger, "Scaling the features");
+
+			try {
+				trainingDataset->scale(*scaler);
+			} catch (ClassificationDatasetException & ex) {
+				LOG4CXX_FATAL(logger, "Unable to scale the features: " << ex.what());
+				exit(-1);
+			}
+
+			LOG4CXX_INFO(logger, "Features scaled in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
+		}
+
 		if(cli_parser.get_classifier_type() == CliParser::ANN)
 		{
 			/*
@@ -224,9 +330,23 @@ int main(int argc, char **argv)
 					 */
 					LOG4CXX_INFO(logger, "Loading validation-classes from a list of images");
 
-					validationDataset = boost::shared_ptr< ClassificationDataset<fann_type> >(
-							new ClassificationDataset<double>(cli_parser.get_ann_validation_images(), cli_parser.get_ann_validation_images_classes())
-					);
+					const uint64_t validation_seed = RandomGenerator::derive(cli_parser.get_random_seed(), 1);
+
+					const std::string cached_validation_dataset_filename = get_cached_dataset_filename(
+							training_set_cache,
+							cli_parser.get_ann_validation_images(), cli_parser.get_ann_validation_images_classes(),
+							cli_parser.get_classifier_max_samples_per_class(), validation_seed);
+
+					validationDataset = load_cached_dataset(cached_validation_dataset_filename);
+
+					if(!validationDataset) {
+						validationDataset = boost::shared_ptr< ClassificationDataset<fann_type> >(
+								new ClassificationDataset<double>(cli_parser.get_ann_validation_images(), cli_parser.get_ann_validation_images_classes(),
+								                                  cli_parser.get_classifier_max_samples_per_class(), validation_seed)
+						);
+
+						cache_dataset(*validationDataset, cached_validation_dataset_filename);
+					}
 
 					if(validationDataset->getInputSize() != trainingDataset->getInputSize()) {
 						LOG4CXX_FATAL(logger, "The validation set do not have the same number of components per pixel than the training set.");
@@ -234,6 +354,9 @@ int main(int argc, char **argv)
 					}
 
 					validationDataset->checkValid();
+
+					if(scaler)
+						validationDataset->scale(*scaler);
 				} catch (ClassificationDatasetException & ex) {
 					LOG4CXX_FATAL(logger, "Unable to load the validation classes: " << ex.what());
 					exit(-1);
@@ -245,7 +368,7 @@ int main(int argc, char **argv)
 				LOG4CXX_INFO(logger, "Generating the validation-set from the training-set with a ratio of " << cli_parser.get_ann_validation_training_ratio());
 
 				try {
-					trainingDataset->shuffle();
+					trainingDataset->shuffle(RandomGenerator::derive(cli_parser.get_random_seed(), 2));
 
 					std::pair< boost::shared_ptr< ClassificationDataset<fann_type> >, boost::shared_ptr< ClassificationDataset<fann_type> > > new_sets =
 						trainingDataset->split(cli_parser.get_ann_validation_training_ratio());
@@ -261,44 +384,107 @@ int main(int argc, char **argv)
 
 			LOG4CXX_INFO(logger, "Validation classes loaded in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
 
-			boost::shared_ptr< FannClassificationDataset > fannTrainingDatasets(new FannClassificationDataset(*trainingDataset)),
-			                                               fannValidationDatasets(new FannClassificationDataset(*validationDataset));
+			// The FannClassificationDatasets reference the patterns of the datasets, they keep them alive.
+			boost::shared_ptr< FannClassificationDataset > fannTrainingDatasets(new FannClassificationDataset(trainingDataset)),
+			                                               fannValidationDatasets(new FannClassificationDataset(validationDataset));
 
-			// TODO Supprimer le training set et le validation-set
-			// They are not needed now that we have the FannClassificationDatasets
 			trainingDataset.reset();
 			validationDataset.reset();
 
-			fannTrainingDatasets->shuffle();
+			fannTrainingDatasets->shuffle(RandomGenerator::derive(cli_parser.get_random_seed(), 3));
 
-			NeuralNetworkPixelClassifiers *ann = new NeuralNetworkPixelClassifiers();
-			pixelClassifier = boost::shared_ptr< Classifier<fann_type> >(ann);
+			const NeuralNetworkPixelClassifiers::Trainer trainer = cli_parser.get_ann_trainer() == CliParser::MINIBATCH_TRAINER
+				? NeuralNetworkPixelClassifiers::MINIBATCH_TRAINER
+				: NeuralNetworkPixelClassifiers::FANN_TRAINER;
 
 			/*
 			 * Training of neural networks
 			 */
 			last_timestamp = get_timestamp();
-			LOG4CXX_INFO(logger, "Training neural networks");
 
-			ann->create_neural_networks(fannTrainingDatasets->getInputSize(), fannTrainingDatasets->getNumberOfDatasets(), cli_parser.get_ann_hidden_layers(), cli_parser.get_ann_learning_rate());
-			ann->train_neural_networks(fannTrainingDatasets.get(), cli_parser.get_ann_max_epoch(), cli_parser.get_ann_mse_target(), fannValidationDatasets.get());
+			if(cli_parser.get_ann_sweep()) {
+				LOG4CXX_INFO(logger, "Comparing neural networks");
+
+				sweep = boost::shared_ptr< NeuralNetworkSweep >(new NeuralNetworkSweep(cli_parser.get_ann_sweep_hidden_layers(), cli_parser.get_ann_sweep_learning_rates()));
+				pixelClassifier = sweep->run(fannTrainingDatasets.get(), fannValidationDatasets.get(), cli_parser.get_ann_max_epoch(), cli_parser.get_ann_mse_target(),
+				                             cli_parser.get_ann_patience(), cli_parser.get_ann_min_improvement(), trainer, cli_parser.get_ann_batch_size());
+			} else {
+				NeuralNetworkPixelClassifiers *ann;
+
+				if(previousClassifier) {
+					// The training continues from the stored networks.
+					ann = static_cast< NeuralNetworkPixelClassifiers* >(previousClassifier.get());
+					pixelClassifier = previousClassifier;
+
+					if(ann->getInputSize() != fannTrainingDatasets->getInputSize()) {
+						LOG4CXX_FATAL(logger, "The neural networks to start the training from work on pixels with " << ann->getInputSize() << " components per pixel, "
+						                   << "but the training-set has " << fannTrainingDatasets->getInputSize() << " components per pixel.");
+						exit(-1);
+					}
+
+					LOG4CXX_INFO(logger, "Training neural networks (warm start)");
+				} else {
+					ann = new NeuralNetworkPixelClassifiers();
+					pixelClassifier = boost::shared_ptr< Classifier<fann_type> >(ann);
+
+					LOG4CXX_INFO(logger, "Training neural networks");
+
+					ann->create_neural_networks(fannTrainingDatasets->getInputSize(), fannTrainingDatasets->getNumberOfDatasets(), cli_parser.get_ann_hidden_layers(), cli_parser.get_ann_learning_rate());
+				}
+
+				ann->setTrainer(trainer, cli_parser.get_ann_batch_size());
+				if(cli_parser.get_ann_checkpoint_interval() > 0) {
+					try {
+						bfs::path classifier_config_dir(cli_parser.get_classifier_config_dir());
+						get_directory(classifier_config_dir);
+					} catch (std::runtime_error &err) {
+						LOG4CXX_FATAL(logger, err.what());
+						exit(-1);
+					}
+				}
+
+				try {
+					ann->train_neural_networks(fannTrainingDatasets.get(), cli_parser.get_ann_max_epoch(), cli_parser.get_ann_mse_target(), fannValidationDatasets.get(),
+					                           cli_parser.get_ann_patience(), cli_parser.get_ann_min_improvement(),
+					                           cli_parser.get_ann_checkpoint_interval(), cli_parser.get_classifier_config_dir());
+				} catch (MinibatchTrainerException &err) {
+					LOG4CXX_FATAL(logger, err.what());
+					exit(-1);
+				}
+			}
 
 			LOG4CXX_INFO(logger, "Neural networks trained in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
 		} else if(cli_parser.get_classifier_type() == CliParser::SVM) {
-			boost::shared_ptr< LibSVMClassificationDataset > svmTrainingDataset(new LibSVMClassificationDataset(*trainingDataset));
+			boost::shared_ptr< LibSVMClassificationDataset > svmTrainingDataset(new LibSVMClassificationDataset(trainingDataset));
 			trainingDataset.reset();
 
+			if(previousClassifier) {
+				LOG4CXX_INFO(logger, "Adding the support vectors of the previous SVM to the training-set");
+
+				try {
+					svmTrainingDataset->addSupportVectors(static_cast< SVMPixelClassifier* >(previousClassifier.get())->getModel());
+				} catch (LibSVMClassificationDatasetException &err) {
+					LOG4CXX_FATAL(logger, err.what());
+					exit(-1);
+				}
+
+				previousClassifier.reset();
+			}
+
 			SVMPixelClassifier *svm = new SVMPixelClassifier();
 			pixelClassifier = boost::shared_ptr< Classifier<fann_type> >(svm);
 
 			last_timestamp = get_timestamp();
 			LOG4CXX_INFO(logger, "Training the SVM");
-			if(!svm->train(svmTrainingDataset.get())) {
+			if(!svm->train(svmTrainingDataset.get(), cli_parser.get_svm_c(), cli_parser.get_svm_gamma(),
+			               cli_parser.get_svm_number_folds(), RandomGenerator::derive(cli_parser.get_random_seed(), 4))) {
 				exit(-1);
 			}
 			LOG4CXX_INFO(logger, "SVM trained in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
 		}
 
+		pixelClassifier->setScaler(scaler);
+
 		/*
 		 * Saving the classifier (if required).
 		 */
@@ -308,6 +494,9 @@ int main(int argc, char **argv)
 			try {
 				get_directory(classifier_config_dir);
 				pixelClassifier->save(cli_parser.get_classifier_config_dir());
+
+				if(sweep)
+					sweep->save(cli_parser.get_classifier_config_dir());
 			} catch (std::runtime_error &err) {
 				LOG4CXX_FATAL(logger, err.what());
 				exit(-1);
@@ -325,38 +514,25 @@ int main(int argc, char **argv)
 	 *
 	 */
 
-	if(cli_parser.get_input_image().empty())
+	if(cli_parser.get_input_image().empty() && cli_parser.get_batch_manifest().empty() && cli_parser.get_daemon_socket().empty())
 		exit(0);
 
-	if((cli_parser.get_classifier_type() == CliParser::ANN) && (pixelClassifier->getInputSize() != input_image->GetNumberOfComponentsPerPixel())) {
-		LOG4CXX_FATAL(logger, "The classifier is configured to work on pixels with " << pixelClassifier->getInputSize() << " components per pixel, "
-		                   << "but the input image has " << input_image->GetNumberOfComponentsPerPixel() << " components per pixel.");
-		exit(-1);
-	}
-
-	bfs::path export_dir_path(cli_parser.get_export_dir());
-	try {
-		get_directory(export_dir_path);
-	} catch (DirException &err) {
-		LOG4CXX_FATAL(logger, err.what());
-		exit(-1);
-	}
-
-	const unsigned int number_of_classifiers = pixelClassifier->getNumberOfClasses() == 2 ? 1 : pixelClassifier->getNumberOfClasses();
-
-	/*
-	 * Creation of the export folders for each class
-	 */
-	if(cli_parser.get_export_interval() > 0) {
+	std::vector< SegmentationJob > jobs;
+	if(!cli_parser.get_batch_manifest().empty()) {
 		try {
-			for(int i = 0; i < number_of_classifiers; ++i)
-				get_directory(export_dir_path / pad(i));
-		} catch (DirException &err) {
+			jobs = read_batch_manifest(cli_parser.get_batch_manifest());
+		} catch (SegmentationException &err) {
 			LOG4CXX_FATAL(logger, err.what());
 			exit(-1);
 		}
+
+		if(jobs.empty()) {
+			LOG4CXX_WARN(logger, "The batch manifest " << cli_parser.get_batch_manifest() << " does not list any image");
+			exit(0);
+		}
 	}
 
+	// Tulip is initialized once, for all the volumes of a batch or of the daemon.
 	if(cli_parser.get_debug()) {
 		PluginLoaderTxt txtLoader;
 		tlp::initTulipSoftware(&txtLoader);
@@ -364,288 +540,38 @@ int main(int argc, char **argv)
 		tlp::initTulipSoftware(NULL);
 	}
 
-	/*
-	 * Creation of the graph structure
-	 */
-	last_timestamp = get_timestamp();
-	LOG4CXX_INFO(logger, "Generating graph structure");
-
-	tlp::DataSet data;
-	data.set("Width",               input_image->GetLargestPossibleRegion().GetSize()[0]);
-	data.set("Height",              input_image->GetLargestPossibleRegion().GetSize()[1]);
-	data.set("Depth",               input_image->GetLargestPossibleRegion().GetSize()[2]);
-	data.set("Neighborhood radius", 1.0);
-	data.set("Neighborhood type",   tlp::StringCollection("Circular"));
-	data.set("Positionning",        true);
-	data.set("Spacing",             1.0);
-
-	tlp::Graph *graph = tlp::importGraph("Grid 3D", data);
-
-	tlp::BooleanProperty *everything = graph->getLocalProperty<tlp::BooleanProperty>("everything");
-	everything->setAllNodeValue(true);
-	everything->setAllEdgeValue(true);
-
-	tlp::BooleanProperty *roi = graph->getLocalProperty<tlp::BooleanProperty>("ROI");
-
-	LOG4CXX_INFO(logger, "Importing region of interest");
-	if(cli_parser.get_region_of_interest().empty()) {
-		LOG4CXX_INFO(logger, "No region of interest specified");
-		roi->setAllNodeValue(true);
-	} else {
-		tlp::DataSet data;
-		std::string error;
-		data.set("file::Image",          cli_parser.get_region_of_interest());
-		data.set("Property",             roi);
-		data.set("Convert to grayscale", false);
-
-		if(!graph->applyAlgorithm("Load image data", error, &data)) {
-			LOG4CXX_FATAL(logger, "Unable to import region of interest: " << error);
-			return -1;
-		}
-		LOG4CXX_INFO(logger, "Region of interest successfully imported");
-	}
-
-
-	tlp::DoubleProperty *weight = graph->getLocalProperty<tlp::DoubleProperty>("Weight");
-	weight->setAllEdgeValue(1);
-
-	tlp::DoubleVectorProperty *features_property = graph->getLocalProperty<tlp::DoubleVectorProperty>("features");
-
-	{ // Copy of the texture features into the graph
-		tlp::Iterator<tlp::node> *itNodes = graph->getNodes();
-		tlp::node u;
-
-		const FeaturesImage::PixelType::ValueType *features_tmp;
-		std::vector<double> features(input_image->GetNumberOfComponentsPerPixel());
-
-		while(itNodes->hasNext())
-		{
-			u = itNodes->next();
-			FeaturesImage::PixelType texture = input_image->GetPixel(input_image->ComputeIndex(u.id));
-
-			features_tmp = texture.GetDataPointer();
-			features.assign(features_tmp, features_tmp + input_image->GetNumberOfComponentsPerPixel());
-			features_property->setNodeValue(u, features);
-		}
-		delete itNodes;
-	}
+	SegmentationParameters parameters;
+	parameters.number_of_iterations = cli_parser.get_num_iter();
+	parameters.lambda = cli_parser.get_lambda();
+	parameters.export_interval = cli_parser.get_export_interval();
+	parameters.export_probability_maps = cli_parser.get_export_probability_maps();
 
-	LOG4CXX_INFO(logger, "Graph structure generated in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
-
-
-	last_timestamp = get_timestamp();
-	LOG4CXX_INFO(logger, "Classifying the pixels");
-
-	std::vector< tlp::DoubleProperty* > regularized_segmentations(number_of_classifiers); 
-
-	std::vector< tlp::Graph* > subgraphs;
-	std::vector< tlp::DoubleProperty* > f0_properties;
-	std::vector< tlp::DoubleProperty* > seed_properties;
-
-	/*
-	 * Classification of the pixels
-	 */
-	for(unsigned int i = 0; i < number_of_classifiers; ++i)
-	{
-		tlp::Graph *subgraph = graph->addSubGraph(everything, pad(i));
-
-		subgraphs.push_back(subgraph);
-		seed_properties.push_back(subgraph->getLocalProperty<tlp::DoubleProperty>("Seed"));
-		f0_properties.push_back(subgraph->getLocalProperty<tlp::DoubleProperty>("f0"));
-	}
-
-	{
-		tlp::Iterator<tlp::node> *itNodes = graph->getNodes();
-		tlp::node u;
-		while(itNodes->hasNext())
-		{
-			u = itNodes->next();
-			if(roi->getNodeValue(u))
-			{
-				std::vector<float> probabilities = pixelClassifier->classify(features_property->getNodeValue(u));
-
-				for(unsigned int i = 0; i < number_of_classifiers; ++i)
-				{
-					f0_properties[i]->setNodeValue(u, probabilities[i]);
-					seed_properties[i]->setNodeValue(u, probabilities[i]);
-				}
-			}
-		}
-		delete itNodes;
-	}
+	if(!cli_parser.get_daemon_socket().empty()) {
+		SegmentationDaemon daemon(cli_parser.get_daemon_socket(), cli_parser.get_daemon_workers(), parameters);
+		daemon.setModel("default", pixelClassifier);
 
-	LOG4CXX_INFO(logger, "Pixels classified in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
-
-	for(unsigned int i = 0; i < number_of_classifiers; ++i)
-	{
-		LOG4CXX_INFO(logger, "Data classification done for image #" << i);
-
-		/*****************************************************/
-		/* Application of the graph regularisation algorithm */
-		/*****************************************************/
-		//LOG4CXX_INFO(logger, "Applying CV Regularization algorithm on image #" << i);
-		LOG4CXX_INFO(logger, "Applying ROF Regularization algorithm on image #" << i);
-
-		bfs::path export_dir = export_dir_path / pad(i);
-
-		DoubleProperty* fn = subgraphs[i]->getLocalProperty< DoubleProperty >("fn");
-		BooleanProperty* segmentation = subgraphs[i]->getLocalProperty< BooleanProperty >("viewSelection");
-
-		DataSet data4;
-		data4.set("seed",                  seed_properties[i]);
-		data4.set("result",                fn);
-		data4.set("segmentation result",   segmentation);
-		data4.set("data",                  f0_properties[i]);
-		data4.set("similarity measure",    weight);
-		data4.set("number of iterations",  cli_parser.get_num_iter());
-		data4.set("lambda",               cli_parser.get_lambda());
-		data4.set("export interval",       cli_parser.get_export_interval());
-		data4.set("dir::export directory", export_dir.native());
-
-		LoggerPluginProgress pp("main.cv_ta");
-
-		string error4;
-		//bool reg_applied = subgraph->applyAlgorithm("ChanVese Regularization", error4, &data4, &pp);
-		bool reg_applied = subgraphs[i]->applyAlgorithm("Rudin-Osher-Fatemi Regularization", error4, &data4, &pp);
-		if(!reg_applied) {
-			LOG4CXX_FATAL(logger, "Unable to apply the ROF Regularization algorithm: " << error4);
+		try {
+			daemon.run();
+		} catch (DaemonException &err) {
+			LOG4CXX_FATAL(logger, err.what());
 			return -1;
 		}
 
-		regularized_segmentations[i] = fn;
-
-		LOG4CXX_INFO(logger, "Regularization done for image #" << i);
+		return 0;
 	}
 
-	if(cli_parser.get_debug()) {
-		bfs::path output_graph = export_dir_path / "graph.tlp";
+	if(!cli_parser.get_batch_manifest().empty()) {
+		const unsigned int number_of_failures = segment_batch(jobs, *pixelClassifier, parameters);
+		return number_of_failures == 0 ? 0 : -1;
 	}
 
-	ImageType::Pointer classification_image = ImageType::New();
-	classification_image->SetRegions(input_image->GetLargestPossibleRegion());
-	classification_image->Allocate();
-	ImageType::IndexType index;
-
-	int width, height, depth;
-	unsigned int id;
-
-	graph->getAttribute<int>("width", width);
-	graph->getAttribute<int>("height", height);
-	graph->getAttribute<int>("depth", depth);
-
-	tlp::Iterator<tlp::node> *itNodes = graph->getNodes();
-	tlp::node u;
-	std::vector< double > values(number_of_classifiers);
-
-	std::vector< double >::iterator max_it;
-	unsigned int max_pos;
-
-	while(itNodes->hasNext())
-	{
-		u = itNodes->next();
-		id = u.id;
-		index[0] =  id % width;
-		id /= width;
-		index[1] = id % height;
-		id /= height;
-		index[2] = id;
-
-		if(roi->getNodeValue(u))
-		{
-			if(number_of_classifiers > 1)
-			{
-				for(unsigned int i = 0; i < number_of_classifiers; ++i)
-				{
-					values[i] = regularized_segmentations[i]->getNodeValue(u);
-				}
-
-				std::vector< size_t > ordered_indices = ordered(values, desc_comparator<double>(values));
-
-				//if( (values[ordered_indices[0]] > 0.5) && ( (0.9 * values[ordered_indices[0]]) > values[ordered_indices[1]]) ) {
-				/*
-				if( values[ordered_indices[0]] > 0.5 ) {
-					max_pos = ordered_indices[0] + 1;
-				} else {
-					max_pos = 0;
-				}
-				*/
-				max_pos = ordered_indices[0] + 1;
-			} else {
-				max_pos = (regularized_segmentations[0]->getNodeValue(u) > 0.5 ? 1 : 2); // No rejected class
-			}
-		} else {
-			max_pos = 0; // XXX Do we set it to 0 when we are supposed to ignore the pixel?
-		}
-
-		classification_image->SetPixel(index, max_pos);
-
-		//copy( &values[0], &values[networks->size()], std::ostream_iterator< double >(std::cout, ", "));
-		//std::cout << std::endl;
-	}
-	delete itNodes;
-
-	bfs::path final_export_dir_path = export_dir_path / "final_export";
-
 	try {
-		get_directory(final_export_dir_path);
-	} catch (DirException &err) {
+		segment(input, *pixelClassifier, parameters, cli_parser.get_export_dir());
+	} catch (std::exception &err) {
 		LOG4CXX_FATAL(logger, err.what());
-		exit(-1);
-	}
-
-	{
-		bfs::path classmap_export_dir_path = final_export_dir_path / "classmap";
-		try {
-			get_directory(classmap_export_dir_path);
-		} catch (DirException &err) {
-			LOG4CXX_FATAL(logger, err.what());
-			exit(-1);
-		}
-
-		bfs::path export_dir_pattern = classmap_export_dir_path / "%06d.bmp";
-		itk::NumericSeriesFileNames::Pointer outputNames = itk::NumericSeriesFileNames::New();
-		outputNames->SetSeriesFormat(export_dir_pattern.native());
-		outputNames->SetStartIndex(0);
-		outputNames->SetEndIndex(depth - 1);
-
-		typedef itk::ImageSeriesWriter< ImageType, itk::Image< unsigned char, 2 > > WriterType;
-		WriterType::Pointer writer = WriterType::New();
-		writer->SetInput(classification_image);
-		writer->SetFileNames(outputNames->GetFileNames());
-		writer->Update();
-	}
-
-	for(int i = 0; i <= number_of_classifiers; ++i)
-	{
-		bfs::path final_class_export_dir_path = final_export_dir_path / (i == 0 ? "rejected" : pad(i));
-
-		try {
-			get_directory(final_class_export_dir_path);
-		} catch (DirException &err) {
-			LOG4CXX_FATAL(logger, err.what());
-			exit(-1);
-		}
-
-		bfs::path final_class_export_dir_pattern = final_class_export_dir_path / "%06d.bmp";
-		itk::NumericSeriesFileNames::Pointer outputNames = itk::NumericSeriesFileNames::New();
-		outputNames->SetSeriesFormat(final_class_export_dir_pattern.native());
-		outputNames->SetStartIndex(0);
-		outputNames->SetEndIndex(depth - 1);
-
-		typedef itk::BinaryThresholdImageFilter< ImageType, ImageType > Thresholder;
-		Thresholder::Pointer thresholder = Thresholder::New();
-		thresholder->SetLowerThreshold(i);
-		thresholder->SetUpperThreshold(i);
-		thresholder->SetInput(classification_image);
-
-		typedef itk::ImageSeriesWriter< ImageType, itk::Image< unsigned char, 2 > > WriterType;
-		WriterType::Pointer writer = WriterType::New();
-		writer->SetInput(thresholder->GetOutput());
-		writer->SetFileNames(outputNames->GetFileNames());
-		writer->Update();
+		return -1;
 	}
 
-	delete graph;
-
 	return 0;
 }
+
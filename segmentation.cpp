@@ -0,0 +1,663 @@
+#include "segmentation.h"
+#include "time_utils.h"
+#include "image_loader.h"
+#include "MetaImageHeader.h"
+#include "LoggerPluginProgress.h"
+
+#include <tulip/Graph.h>
+#include <tulip/TlpTools.h>
+#include <tulip/StringCollection.h>
+#include <tulip/DoubleProperty.h>
+#include <tulip/BooleanProperty.h>
+
+#include <boost/filesystem.hpp>
+
+#include <itkImageSeriesWriter.h>
+#include <itkNumericSeriesFileNames.h>
+#include <itkBinaryThresholdImageFilter.h>
+#include "itkObjectFactoryBase.h"
+
+#include "log4cxx/logger.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace bfs = boost::filesystem;
+
+namespace {
+
+//bool desc_comparator(const T a, const T b) { return a > b; }
+template <typename T>
+class desc_comparator {
+public:
+	desc_comparator(std::vector<T> const & values) :m_values(values) {}
+	inline bool operator() (size_t a, size_t b) { return m_values[a] > m_values[b]; }
+private:
+	std::vector<T> const& m_values;
+};
+
+template <typename T>
+std::vector<size_t> ordered(std::vector<T> const& values, desc_comparator<T> comparator) {
+	std::vector<size_t> indices(values.size());
+	//std::iota(begin(indices), end(indices), static_cast<size_t>(0)); // cxx11
+	for (size_t i = 0; i != indices.size(); ++i) indices[i] = i;
+
+	std::sort( indices.begin(), indices.end(), comparator );
+
+	return indices;
+}
+
+std::string pad(const unsigned int i, const char c = '0', const unsigned int l = 6) {
+	std::ostringstream os;
+	os << std::setfill(c) << std::setw(l) << i;
+	return os.str();
+}
+
+/**
+ * Computes the bounding box of the white pixels of a mask.
+ * The returned region is empty if the mask does not contain any white pixel.
+ */
+ImageType::RegionType bounding_box(ImageType::Pointer mask)
+{
+	const ImageType::SizeType size = mask->GetLargestPossibleRegion().GetSize();
+	const ImageType::PixelType *p = mask->GetBufferPointer();
+
+	ImageType::IndexType lower, upper;
+	lower[0] = size[0]; lower[1] = size[1]; lower[2] = size[2];
+	upper[0] = -1;      upper[1] = -1;      upper[2] = -1;
+
+	for(ImageType::SizeValueType z = 0; z < size[2]; ++z)
+		for(ImageType::SizeValueType y = 0; y < size[1]; ++y)
+			for(ImageType::SizeValueType x = 0; x < size[0]; ++x, ++p)
+				if(255 == *p) {
+					ImageType::IndexType index;
+					index[0] = static_cast< ImageType::IndexValueType >(x);
+					index[1] = static_cast< ImageType::IndexValueType >(y);
+					index[2] = static_cast< ImageType::IndexValueType >(z);
+
+					for(unsigned int d = 0; d < __ImageDimension; ++d) {
+						lower[d] = std::min(lower[d], index[d]);
+						upper[d] = std::max(upper[d], index[d]);
+					}
+				}
+
+	ImageType::SizeType box_size;
+	for(unsigned int d = 0; d < __ImageDimension; ++d)
+		box_size[d] = upper[d] < lower[d] ? 0 : upper[d] - lower[d] + 1;
+
+	if(upper[0] < lower[0])
+		lower.Fill(0);
+
+	return ImageType::RegionType(lower, box_size);
+}
+
+/** Tulip is not thread safe: the stages of concurrent segmentations using it are serialized. */
+boost::mutex tulip_mutex;
+
+/** Creates the directory if needed (see get_directory()), throws a SegmentationException otherwise. */
+void get_export_directory(const bfs::path &path)
+{
+	try {
+		get_directory(path);
+	} catch (DirException &err) {
+		throw SegmentationException(err.what());
+	}
+}
+
+}
+
+void get_directory(const bfs::path &path, const bool mustBeEmpty) {
+	if(bfs::exists(path)) {
+		if(bfs::is_directory(path)) {
+			if(mustBeEmpty && !bfs::is_empty(path))
+				throw DirException::NotEmpty(path);
+		} else
+			throw DirException::File(path);
+	} else {
+		if(!bfs::create_directories(path))
+			throw DirException::CannotCreate(path);
+	}
+}
+
+SegmentationInput load_segmentation_input(const SegmentationJob &job, const bool load_full_image)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	const timestamp_t start = get_timestamp();
+	LOG4CXX_INFO(logger, "Loading features image " << job.input_image);
+
+	SegmentationInput input;
+
+	try {
+		if(job.region_of_interest.empty()) {
+			input.image = ImageLoader::loadFeatures(job.input_image);
+			input.reference_image = input.image;
+			input.domain = input.image->GetLargestPossibleRegion();
+
+			if(load_full_image)
+				input.full_image = input.image;
+		} else {
+			input.reference_image = ImageLoader::loadFeaturesInformation(job.input_image);
+
+			LOG4CXX_INFO(logger, "Importing region of interest");
+			ImageType::Pointer full_roi_image = ImageLoader::load(job.region_of_interest);
+
+			if(full_roi_image->GetLargestPossibleRegion().GetSize() != input.reference_image->GetLargestPossibleRegion().GetSize()) {
+				std::ostringstream err;
+				err << "The dimensions of the region of interest (" << full_roi_image->GetLargestPossibleRegion().GetSize()
+				    << ") differs from the dimensions of the input image (" << input.reference_image->GetLargestPossibleRegion().GetSize() << ")";
+				throw SegmentationException(err.str());
+			}
+
+			input.domain = bounding_box(full_roi_image);
+
+			if(input.domain.GetNumberOfPixels() == 0)
+				throw SegmentationException("The region of interest is empty.");
+
+			LOG4CXX_INFO(logger, "Processing restricted to the bounding box of the region of interest: " << input.domain);
+
+			input.roi_image = ImageLoader::crop(full_roi_image, input.domain);
+
+			if(load_full_image) {
+				// The masks of the training classes cover the whole image.
+				input.full_image = ImageLoader::loadFeatures(job.input_image);
+				input.image = ImageLoader::crop(input.full_image, input.domain);
+			} else {
+				input.image = ImageLoader::loadFeatures(job.input_image, input.domain);
+			}
+		}
+	} catch (ImageLoadingException &ex) {
+		throw SegmentationException(ex.what());
+	}
+
+	LOG4CXX_INFO(logger, "Features image loaded in " << elapsed_time(start, get_timestamp()) << "s");
+
+	return input;
+}
+
+void segment(const SegmentationInput &input, Classifier<fann_type> &classifier, const SegmentationParameters &parameters, const std::string &export_dir,
+             SegmentationTimings *timings, boost::mutex *classifier_mutex)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	timestamp_t last_timestamp;
+	SegmentationTimings stage_timings = SegmentationTimings();
+
+	const FeaturesImage::Pointer input_image = input.image;
+	const FeaturesImage::Pointer reference_image = input.reference_image;
+	const FeaturesImage::RegionType &domain = input.domain;
+
+	const unsigned int number_of_components = input_image->GetNumberOfComponentsPerPixel();
+
+	if(classifier.getInputSize() != 0 && classifier.getInputSize() != number_of_components) {
+		std::ostringstream err;
+		err << "The classifier is configured to work on pixels with " << classifier.getInputSize() << " components per pixel, "
+		    << "but the input image has " << number_of_components << " components per pixel.";
+		throw SegmentationException(err.str());
+	}
+
+	bfs::path export_dir_path(export_dir);
+	get_export_directory(export_dir_path);
+
+	const unsigned int number_of_classifiers = classifier.getNumberOfClasses() == 2 ? 1 : classifier.getNumberOfClasses();
+
+	/*
+	 * Creation of the export folders for each class
+	 */
+	if(parameters.export_interval > 0) {
+		for(int i = 0; i < number_of_classifiers; ++i)
+			get_export_directory(export_dir_path / pad(i));
+	}
+
+	// The nodes of the grid are the pixels of the domain, in the order of the buffer of the image.
+	const size_t number_of_pixels = domain.GetNumberOfPixels();
+	const ImageType::PixelType *roi_values = input.roi_image.IsNull() ? NULL : input.roi_image->GetBufferPointer();
+
+	/*
+	 * Classification of the pixels, directly from the features image (the graph
+	 * does not hold the features), so it does not wait for Tulip.
+	 * The probabilities of the classes of pixel p are f0[p * number_of_classifiers + i].
+	 */
+	last_timestamp = get_timestamp();
+	LOG4CXX_INFO(logger, "Classifying the pixels");
+
+	std::vector< float > f0(number_of_pixels * number_of_classifiers, 0);
+
+	{
+		boost::shared_ptr< boost::lock_guard< boost::mutex > > classifier_lock;
+		if(classifier_mutex != NULL)
+			classifier_lock.reset(new boost::lock_guard< boost::mutex >(*classifier_mutex));
+
+		const FeaturesImage::InternalPixelType *features = input_image->GetBufferPointer();
+		std::vector< fann_type > pattern(number_of_components);
+
+		for(size_t p = 0; p < number_of_pixels; ++p, features += number_of_components)
+		{
+			if(roi_values == NULL || 255 == roi_values[p])
+			{
+				pattern.assign(features, features + number_of_components);
+				const std::vector<float> probabilities = classifier.classify(pattern);
+
+				std::copy(probabilities.begin(), probabilities.begin() + number_of_classifiers, f0.begin() + p * number_of_classifiers);
+			}
+		}
+	}
+
+	stage_timings.classification = elapsed_time(last_timestamp, get_timestamp());
+	LOG4CXX_INFO(logger, "Pixels classified in " << stage_timings.classification << "s");
+
+	// The regularized probabilities, in the layout of f0.
+	std::vector< float > fn(number_of_pixels * number_of_classifiers, 0);
+
+	{
+		last_timestamp = get_timestamp();
+		boost::lock_guard< boost::mutex > tulip_lock(tulip_mutex);
+		stage_timings.waiting = elapsed_time(last_timestamp, get_timestamp());
+
+		/*
+		 * Creation of the graph structure
+		 */
+		last_timestamp = get_timestamp();
+		LOG4CXX_INFO(logger, "Generating graph structure");
+
+		tlp::DataSet data;
+		data.set("Width",               input_image->GetLargestPossibleRegion().GetSize()[0]);
+		data.set("Height",              input_image->GetLargestPossibleRegion().GetSize()[1]);
+		data.set("Depth",               input_image->GetLargestPossibleRegion().GetSize()[2]);
+		data.set("Neighborhood radius", 1.0);
+		data.set("Neighborhood type",   tlp::StringCollection("Circular"));
+		data.set("Positionning",        true);
+		data.set("Spacing",             1.0);
+
+		// The graph is deleted when leaving this block (before the lock is released), even on error.
+		boost::shared_ptr< tlp::Graph > graph_holder(tlp::importGraph("Grid 3D", data));
+		tlp::Graph *graph = graph_holder.get();
+
+		tlp::BooleanProperty *everything = graph->getLocalProperty<tlp::BooleanProperty>("everything");
+		everything->setAllNodeValue(true);
+		everything->setAllEdgeValue(true);
+
+		tlp::BooleanProperty *roi = graph->getLocalProperty<tlp::BooleanProperty>("ROI");
+
+		if(roi_values == NULL) {
+			LOG4CXX_INFO(logger, "No region of interest specified");
+			roi->setAllNodeValue(true);
+		} else {
+			tlp::Iterator<tlp::node> *itNodes = graph->getNodes();
+			tlp::node u;
+			while(itNodes->hasNext())
+			{
+				u = itNodes->next();
+				roi->setNodeValue(u, 255 == roi_values[u.id]);
+			}
+			delete itNodes;
+
+			LOG4CXX_INFO(logger, "Region of interest successfully imported");
+		}
+
+
+		tlp::DoubleProperty *weight = graph->getLocalProperty<tlp::DoubleProperty>("Weight");
+		weight->setAllEdgeValue(1);
+
+		std::vector< tlp::Graph* > subgraphs;
+		std::vector< tlp::DoubleProperty* > f0_properties;
+		std::vector< tlp::DoubleProperty* > seed_properties;
+
+		for(unsigned int i = 0; i < number_of_classifiers; ++i)
+		{
+			tlp::Graph *subgraph = graph->addSubGraph(everything, pad(i));
+
+			subgraphs.push_back(subgraph);
+			seed_properties.push_back(subgraph->getLocalProperty<tlp::DoubleProperty>("Seed"));
+			f0_properties.push_back(subgraph->getLocalProperty<tlp::DoubleProperty>("f0"));
+		}
+
+		{
+			tlp::Iterator<tlp::node> *itNodes = graph->getNodes();
+			tlp::node u;
+			while(itNodes->hasNext())
+			{
+				u = itNodes->next();
+				if(roi->getNodeValue(u))
+				{
+					for(unsigned int i = 0; i < number_of_classifiers; ++i)
+					{
+						f0_properties[i]->setNodeValue(u, f0[u.id * number_of_classifiers + i]);
+						seed_properties[i]->setNodeValue(u, f0[u.id * number_of_classifiers + i]);
+					}
+				}
+			}
+			delete itNodes;
+		}
+
+		LOG4CXX_INFO(logger, "Graph structure generated in " << elapsed_time(last_timestamp, get_timestamp()) << "s");
+
+		for(unsigned int i = 0; i < number_of_classifiers; ++i)
+		{
+			LOG4CXX_INFO(logger, "Data classification done for image #" << i);
+
+			/*****************************************************/
+			/* Application of the graph regularisation algorithm */
+			/*****************************************************/
+			//LOG4CXX_INFO(logger, "Applying CV Regularization algorithm on image #" << i);
+			LOG4CXX_INFO(logger, "Applying ROF Regularization algorithm on image #" << i);
+
+			bfs::path class_export_dir = export_dir_path / pad(i);
+
+			tlp::DoubleProperty* fn_property = subgraphs[i]->getLocalProperty< tlp::DoubleProperty >("fn");
+			tlp::BooleanProperty* segmentation = subgraphs[i]->getLocalProperty< tlp::BooleanProperty >("viewSelection");
+
+			tlp::DataSet data4;
+			data4.set("seed",                  seed_properties[i]);
+			data4.set("result",                fn_property);
+			data4.set("segmentation result",   segmentation);
+			data4.set("data",                  f0_properties[i]);
+			data4.set("similarity measure",    weight);
+			data4.set("number of iterations",  parameters.number_of_iterations);
+			data4.set("lambda",               parameters.lambda);
+			data4.set("export interval",       parameters.export_interval);
+			data4.set("dir::export directory", class_export_dir.native());
+
+			LoggerPluginProgress pp("main.cv_ta");
+
+			std::string error4;
+			//bool reg_applied = subgraph->applyAlgorithm("ChanVese Regularization", error4, &data4, &pp);
+			bool reg_applied = subgraphs[i]->applyAlgorithm("Rudin-Osher-Fatemi Regularization", error4, &data4, &pp);
+			if(!reg_applied)
+				throw SegmentationException("Unable to apply the ROF Regularization algorithm: " + error4);
+
+			tlp::Iterator<tlp::node> *itNodes = graph->getNodes();
+			tlp::node u;
+			while(itNodes->hasNext())
+			{
+				u = itNodes->next();
+				if(roi->getNodeValue(u))
+					fn[u.id * number_of_classifiers + i] = fn_property->getNodeValue(u);
+			}
+			delete itNodes;
+
+			LOG4CXX_INFO(logger, "Regularization done for image #" << i);
+		}
+
+		stage_timings.regularization = elapsed_time(last_timestamp, get_timestamp());
+	}
+
+	last_timestamp = get_timestamp();
+
+	/*
+	 * The results computed on the domain are pasted in a full-size image,
+	 * the pixels outside of the domain are rejected.
+	 */
+	ImageType::Pointer classification_image = ImageType::New();
+	classification_image->SetRegions(reference_image->GetLargestPossibleRegion());
+	classification_image->Allocate();
+	classification_image->FillBuffer(0);
+	ImageType::IndexType index;
+
+	const int depth = reference_image->GetLargestPossibleRegion().GetSize()[2];
+
+	std::vector< double > values(number_of_classifiers);
+
+	std::vector< double >::iterator max_it;
+	unsigned int max_pos;
+
+	for(size_t p = 0; p < number_of_pixels; ++p)
+	{
+		index = input_image->ComputeIndex(p);
+		for(unsigned int d = 0; d < __ImageDimension; ++d)
+			index[d] += domain.GetIndex()[d];
+
+		if(roi_values == NULL || 255 == roi_values[p])
+		{
+			if(number_of_classifiers > 1)
+			{
+				for(unsigned int i = 0; i < number_of_classifiers; ++i)
+				{
+					values[i] = fn[p * number_of_classifiers + i];
+				}
+
+				std::vector< size_t > ordered_indices = ordered(values, desc_comparator<double>(values));
+
+				//if( (values[ordered_indices[0]] > 0.5) && ( (0.9 * values[ordered_indices[0]]) > values[ordered_indices[1]]) ) {
+				/*
+				if( values[ordered_indices[0]] > 0.5 ) {
+					max_pos = ordered_indices[0] + 1;
+				} else {
+					max_pos = 0;
+				}
+				*/
+				max_pos = ordered_indices[0] + 1;
+			} else {
+				max_pos = (fn[p] > 0.5 ? 1 : 2); // No rejected class
+			}
+		} else {
+			max_pos = 0; // XXX Do we set it to 0 when we are supposed to ignore the pixel?
+		}
+
+		classification_image->SetPixel(index, max_pos);
+	}
+
+	bfs::path final_export_dir_path = export_dir_path / "final_export";
+	get_export_directory(final_export_dir_path);
+
+	if(parameters.export_probability_maps)
+	{
+		const timestamp_t maps_timestamp = get_timestamp();
+		LOG4CXX_INFO(logger, "Exporting probability maps");
+
+		bfs::path probabilities_export_dir_path = final_export_dir_path / "probabilities";
+		get_export_directory(probabilities_export_dir_path);
+
+		MetaImageHeader header;
+		header.element_type = "MET_FLOAT";
+		for(unsigned int d = 0; d < __ImageDimension; ++d) {
+			header.dim_size.push_back(reference_image->GetLargestPossibleRegion().GetSize()[d]);
+			header.element_spacing.push_back(reference_image->GetSpacing()[d]);
+			header.offset.push_back(reference_image->GetOrigin()[d]);
+		}
+
+		// The raw files are written through their mapping, voxels outside of the ROI are left to 0.
+		std::vector< boost::shared_ptr< MappedFile > > maps;
+		std::vector< float* > f0_maps(number_of_classifiers), fn_maps(number_of_classifiers);
+
+		try {
+			for(unsigned int i = 0; i < number_of_classifiers; ++i)
+			{
+				header.element_data_file = "f0-" + pad(i) + ".raw";
+				maps.push_back(header.create((probabilities_export_dir_path / ("f0-" + pad(i) + ".mhd")).native()));
+				f0_maps[i] = reinterpret_cast< float* >(maps.back()->data());
+
+				header.element_data_file = "fn-" + pad(i) + ".raw";
+				maps.push_back(header.create((probabilities_export_dir_path / ("fn-" + pad(i) + ".mhd")).native()));
+				fn_maps[i] = reinterpret_cast< float* >(maps.back()->data());
+			}
+		} catch (MetaImageException &err) {
+			throw SegmentationException(std::string("Unable to export the probability maps: ") + err.what());
+		}
+
+		for(size_t p = 0; p < number_of_pixels; ++p)
+		{
+			if(roi_values == NULL || 255 == roi_values[p])
+			{
+				index = input_image->ComputeIndex(p);
+				for(unsigned int d = 0; d < __ImageDimension; ++d)
+					index[d] += domain.GetIndex()[d];
+
+				const itk::OffsetValueType offset = classification_image->ComputeOffset(index);
+
+				for(unsigned int i = 0; i < number_of_classifiers; ++i)
+				{
+					f0_maps[i][offset] = f0[p * number_of_classifiers + i];
+					fn_maps[i][offset] = fn[p * number_of_classifiers + i];
+				}
+			}
+		}
+
+		try {
+			for(std::vector< boost::shared_ptr< MappedFile > >::iterator it = maps.begin(); it != maps.end(); ++it)
+				(*it)->sync();
+		} catch (MappedFileException &err) {
+			throw SegmentationException(std::string("Unable to export the probability maps: ") + err.what());
+		}
+
+		LOG4CXX_INFO(logger, "Probability maps exported in " << elapsed_time(maps_timestamp, get_timestamp()) << "s");
+	}
+
+	{
+		bfs::path classmap_export_dir_path = final_export_dir_path / "classmap";
+		get_export_directory(classmap_export_dir_path);
+
+		bfs::path export_dir_pattern = classmap_export_dir_path / "%06d.bmp";
+		itk::NumericSeriesFileNames::Pointer outputNames = itk::NumericSeriesFileNames::New();
+		outputNames->SetSeriesFormat(export_dir_pattern.native());
+		outputNames->SetStartIndex(0);
+		outputNames->SetEndIndex(depth - 1);
+
+		typedef itk::ImageSeriesWriter< ImageType, itk::Image< unsigned char, 2 > > WriterType;
+		WriterType::Pointer writer = WriterType::New();
+		writer->SetInput(classification_image);
+		writer->SetFileNames(outputNames->GetFileNames());
+		writer->Update();
+	}
+
+	for(int i = 0; i <= number_of_classifiers; ++i)
+	{
+		bfs::path final_class_export_dir_path = final_export_dir_path / (i == 0 ? "rejected" : pad(i));
+		get_export_directory(final_class_export_dir_path);
+
+		bfs::path final_class_export_dir_pattern = final_class_export_dir_path / "%06d.bmp";
+		itk::NumericSeriesFileNames::Pointer outputNames = itk::NumericSeriesFileNames::New();
+		outputNames->SetSeriesFormat(final_class_export_dir_pattern.native());
+		outputNames->SetStartIndex(0);
+		outputNames->SetEndIndex(depth - 1);
+
+		typedef itk::BinaryThresholdImageFilter< ImageType, ImageType > Thresholder;
+		Thresholder::Pointer thresholder = Thresholder::New();
+		thresholder->SetLowerThreshold(i);
+		thresholder->SetUpperThreshold(i);
+		thresholder->SetInput(classification_image);
+
+		typedef itk::ImageSeriesWriter< ImageType, itk::Image< unsigned char, 2 > > WriterType;
+		WriterType::Pointer writer = WriterType::New();
+		writer->SetInput(thresholder->GetOutput());
+		writer->SetFileNames(outputNames->GetFileNames());
+		writer->Update();
+	}
+
+	stage_timings.exports = elapsed_time(last_timestamp, get_timestamp());
+
+	if(timings != NULL) {
+		stage_timings.loading = timings->loading;
+		*timings = stage_timings;
+	}
+}
+
+std::vector< SegmentationJob > read_batch_manifest(const std::string &filename)
+{
+	std::ifstream file(filename.c_str());
+	if(!file)
+		throw SegmentationException("Cannot open the batch manifest " + filename);
+
+	std::vector< SegmentationJob > jobs;
+	std::string line;
+
+	for(unsigned int line_number = 1; std::getline(file, line); ++line_number)
+	{
+		std::istringstream fields(line);
+		SegmentationJob job;
+
+		if(!(fields >> job.input_image) || job.input_image[0] == '#')
+			continue;
+
+		std::string extra;
+		if(!(fields >> job.region_of_interest >> job.export_dir) || (fields >> extra)) {
+			std::ostringstream err;
+			err << "Invalid line " << line_number << " in the batch manifest " << filename << " (expected: input image, region of interest or -, export directory)";
+			throw SegmentationException(err.str());
+		}
+
+		if(job.region_of_interest == "-")
+			job.region_of_interest.clear();
+
+		jobs.push_back(job);
+	}
+
+	return jobs;
+}
+
+unsigned int segment_batch(const std::vector< SegmentationJob > &jobs, Classifier<fann_type> &classifier, const SegmentationParameters &parameters)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	if(jobs.empty())
+		return 0;
+
+	// Make sure ITK's factories are registered before the readers and writers are created concurrently.
+	itk::ObjectFactoryBase::GetRegisteredFactories();
+
+	const timestamp_t batch_start = get_timestamp();
+	unsigned int number_of_failures = 0;
+
+	boost::shared_ptr< SegmentationInputLoader > loader(new SegmentationInputLoader(jobs.front()));
+
+	for(size_t j = 0; j < jobs.size(); ++j)
+	{
+		const timestamp_t start = get_timestamp();
+		LOG4CXX_INFO(logger, "Segmenting volume " << (j + 1) << "/" << jobs.size() << ": " << jobs[j].input_image);
+
+		// The next volume is loaded during the segmentation of this one (even if this one fails).
+		boost::shared_ptr< SegmentationInputLoader > current;
+		current.swap(loader);
+		if(j + 1 < jobs.size())
+			loader = boost::shared_ptr< SegmentationInputLoader >(new SegmentationInputLoader(jobs[j + 1]));
+
+		try {
+			const SegmentationInput input = current->get();
+			current.reset();
+
+			segment(input, classifier, parameters, jobs[j].export_dir);
+
+			LOG4CXX_INFO(logger, "Volume " << (j + 1) << "/" << jobs.size() << " segmented in " << elapsed_time(start, get_timestamp()) << "s");
+		} catch (std::exception &ex) {
+			LOG4CXX_ERROR(logger, "Cannot segment " << jobs[j].input_image << ": " << ex.what());
+			++number_of_failures;
+		}
+	}
+
+	LOG4CXX_INFO(logger, (jobs.size() - number_of_failures) << "/" << jobs.size() << " volumes segmented in " << elapsed_time(batch_start, get_timestamp()) << "s");
+
+	return number_of_failures;
+}
+
+SegmentationInputLoader::SegmentationInputLoader(const SegmentationJob &job) :
+	m_Job(job),
+	m_Thread(&SegmentationInputLoader::run, this)
+{}
+
+SegmentationInputLoader::~SegmentationInputLoader()
+{
+	if(m_Thread.joinable())
+		m_Thread.join();
+}
+
+void SegmentationInputLoader::run()
+{
+	try {
+		m_Input = load_segmentation_input(m_Job);
+	} catch (std::exception &ex) {
+		m_Error = ex.what();
+	}
+}
+
+SegmentationInput SegmentationInputLoader::get()
+{
+	if(m_Thread.joinable())
+		m_Thread.join();
+
+	if(!m_Error.empty())
+		throw SegmentationException(m_Error);
+
+	return m_Input;
+}
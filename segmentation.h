@@ -0,0 +1,170 @@
+#ifndef SEGMENTATION_H
+#define SEGMENTATION_H
+
+#include "common.h"
+#include "Classifier.h"
+
+#include "doublefann.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+class SegmentationException : public std::runtime_error
+{
+public:
+	SegmentationException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+class DirException : public std::runtime_error
+{
+private:
+	DirException ( const std::string &err ) : std::runtime_error (err) {}
+public:
+	static DirException NotEmpty(const boost::filesystem::path &path) {     return DirException(path.native() + " is not empty."); }
+	static DirException File(const boost::filesystem::path &path) {         return DirException(path.native() + " is a file."); }
+	static DirException CannotCreate(const boost::filesystem::path &path) { return DirException(path.native() + " cannot be created."); }
+};
+
+/** Creates a directory (and its parents) if it does not exist. */
+void get_directory(const boost::filesystem::path &path, const bool mustBeEmpty = false);
+
+/** A volume to segment: its features image, its region of interest (optional) and where to export the results. */
+struct SegmentationJob
+{
+	std::string input_image;
+	std::string region_of_interest;
+	std::string export_dir;
+};
+
+/**
+ * A features image loaded in memory.
+ *
+ * When a region of interest is specified, the processing is restricted to its
+ * bounding box (the domain), and image only holds the domain.
+ */
+struct SegmentationInput
+{
+	/** The features of the domain. */
+	FeaturesImage::Pointer image;
+
+	/** The geometry of the whole input image (it may have no buffer). */
+	FeaturesImage::Pointer reference_image;
+
+	/** The region of interest, cropped to the domain (null if there is none). */
+	ImageType::Pointer roi_image;
+
+	FeaturesImage::RegionType domain;
+
+	/** The whole features image, only loaded on demand (see load_segmentation_input()). */
+	FeaturesImage::Pointer full_image;
+};
+
+/** The parameters of the regularization and of the exports. */
+struct SegmentationParameters
+{
+	int number_of_iterations;
+	double lambda;
+	int export_interval;
+	bool export_probability_maps;
+};
+
+/** The time spent in each stage of a segmentation, in seconds. */
+struct SegmentationTimings
+{
+	/** Loading of the features image (measured by the caller of load_segmentation_input()). */
+	float loading;
+	float classification;
+
+	/** Waiting for the segmentations using Tulip at the same time. */
+	float waiting;
+
+	/** Construction of the graph and regularization. */
+	float regularization;
+	float exports;
+};
+
+/**
+ * Loads the features image of a job, restricted to the bounding box of its region of interest.
+ *
+ * @param load_full_image Also loads the whole features image in SegmentationInput::full_image
+ *        (when the classifier is trained on the input image, its masks cover the whole image).
+ *
+ * \throw SegmentationException if the image or the region of interest cannot be loaded.
+ */
+SegmentationInput load_segmentation_input(const SegmentationJob &job, const bool load_full_image = false);
+
+/**
+ * Classifies the pixels of the domain, regularizes the probabilities of each class on a
+ * graph of the pixels (with the Tulip plugin "Rudin-Osher-Fatemi Regularization", so Tulip
+ * must have been initialized), and exports the class map in export_dir.
+ *
+ * Several segmentations can run concurrently: only the construction of the graph and the
+ * regularization (which use Tulip) are serialized.
+ *
+ * @param timings If not NULL, receives the time spent in each stage (loading is kept).
+ * @param classifier_mutex If not NULL, held while the pixels are classified, for the
+ *        classifiers which cannot be used by several threads at the same time (FANN stores
+ *        the outputs of the neurons in the network).
+ *
+ * \throw SegmentationException if the segmentation fails.
+ */
+void segment(const SegmentationInput &input, Classifier<fann_type> &classifier, const SegmentationParameters &parameters, const std::string &export_dir,
+             SegmentationTimings *timings = NULL, boost::mutex *classifier_mutex = NULL);
+
+/**
+ * Reads a batch manifest: one job per line, made of the input image, the region of interest
+ * ("-" if none) and the export directory, separated by spaces or tabs.
+ * Empty lines and lines starting with '#' are ignored.
+ *
+ * \throw SegmentationException if the file cannot be read or a line is invalid.
+ */
+std::vector< SegmentationJob > read_batch_manifest(const std::string &filename);
+
+/**
+ * Segments the volumes of a batch with the same classifier, one after the other. The next
+ * volume is loaded while the current one is segmented (see SegmentationInputLoader), so two
+ * volumes are in memory at the same time. A failed job is logged and skipped.
+ *
+ * \return The number of failed jobs.
+ */
+unsigned int segment_batch(const std::vector< SegmentationJob > &jobs, Classifier<fann_type> &classifier, const SegmentationParameters &parameters);
+
+/**
+ * \class SegmentationInputLoader
+ *
+ * \brief Loads the input of a job in a thread, so it overlaps with the segmentation of the
+ * previous job.
+ *
+ * A thread is used instead of an OpenMP task: the segmentation would then run inside a
+ * parallel region, where the parallel regions it opens get a single thread.
+ */
+class SegmentationInputLoader : private boost::noncopyable
+{
+public:
+	/** Starts loading the input of a job. */
+	SegmentationInputLoader(const SegmentationJob &job);
+
+	/** Waits for the thread. */
+	~SegmentationInputLoader();
+
+	/**
+	 * Waits for the end of the loading.
+	 *
+	 * \throw SegmentationException if the input cannot be loaded.
+	 */
+	SegmentationInput get();
+
+private:
+	void run();
+
+	SegmentationJob m_Job;
+	SegmentationInput m_Input;
+	std::string m_Error;
+	boost::thread m_Thread;
+};
+
+#endif /* SEGMENTATION_H */
@@ -0,0 +1,465 @@
+// The JSON parser of property_tree is only thread safe with this definition.
+#define BOOST_SPIRIT_THREADSAFE
+
+#include "segmentation_daemon.h"
+#include "NeuralNetworkPixelClassifiers.h"
+#include "SVMPixelClassifier.h"
+
+#include <boost/property_tree/json_parser.hpp>
+
+#include "itkObjectFactoryBase.h"
+
+#include "log4cxx/logger.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+/** A request which does not fit in this size is rejected (the connection is closed). */
+const size_t MaxRequestSize = 1 << 20;
+
+const char* job_status_name(const int status)
+{
+	static const char *names[] = { "queued", "running", "done", "failed" };
+	return names[status];
+}
+
+/** Sends the whole buffer, returns false if the connection is closed. */
+bool send_all(const int connection, const std::string &data)
+{
+	size_t sent = 0;
+	while(sent < data.size()) {
+		const ssize_t n = send(connection, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		sent += n;
+	}
+
+	return true;
+}
+
+}
+
+const size_t SegmentationDaemon::MaxFinishedJobs;
+
+SegmentationDaemon::SegmentationDaemon(const std::string &socket_path, const unsigned int number_of_workers, const SegmentationParameters &parameters) :
+	m_SocketPath(socket_path),
+	m_NumberOfWorkers(number_of_workers),
+	m_Parameters(parameters),
+	m_Socket(-1),
+	m_Stopping(false),
+	m_NextJobId(1),
+	m_NumberOfRunningJobs(0)
+{}
+
+SegmentationDaemon::~SegmentationDaemon()
+{
+	if(m_Socket >= 0)
+		close(m_Socket);
+}
+
+void SegmentationDaemon::setModel(const std::string &name, boost::shared_ptr< Classifier<fann_type> > classifier)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	Model model;
+	model.classifier = classifier;
+
+	// fann_run() stores the outputs of the neurons in the network.
+	if(dynamic_cast< NeuralNetworkPixelClassifiers* >(classifier.get()) != NULL)
+		model.classify_mutex = boost::shared_ptr< boost::mutex >(new boost::mutex);
+
+	{
+		boost::lock_guard< boost::mutex > lock(m_ModelsMutex);
+		m_Models[name] = model;
+	}
+
+	LOG4CXX_INFO(logger, "Model \"" << name << "\" ready");
+}
+
+void SegmentationDaemon::loadModel(const std::string &name, const std::string &classifier_config_dir, const std::string &classifier_type)
+{
+	boost::shared_ptr< Classifier<fann_type> > classifier;
+
+	if(classifier_type == "ann")
+		classifier = boost::shared_ptr< Classifier<fann_type> >(new NeuralNetworkPixelClassifiers);
+	else if(classifier_type == "svm")
+		classifier = boost::shared_ptr< Classifier<fann_type> >(new SVMPixelClassifier);
+	else
+		throw DaemonException("Unknown classifier type \"" + classifier_type + "\" (ann or svm).");
+
+	// The model is loaded before it replaces the previous one, which remains usable meanwhile.
+	try {
+		classifier->load(classifier_config_dir);
+	} catch (std::runtime_error &err) {
+		throw DaemonException("Cannot load the model \"" + name + "\" from " + classifier_config_dir + ": " + err.what());
+	}
+
+	setModel(name, classifier);
+}
+
+void SegmentationDaemon::run()
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	// Make sure ITK's factories are registered before the readers and writers are created concurrently.
+	itk::ObjectFactoryBase::GetRegisteredFactories();
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if(m_SocketPath.size() >= sizeof(address.sun_path))
+		throw DaemonException("The socket path " + m_SocketPath + " is too long.");
+	strcpy(address.sun_path, m_SocketPath.c_str());
+
+	// A socket left by a previous daemon is replaced.
+	struct stat socket_stat;
+	if(stat(m_SocketPath.c_str(), &socket_stat) == 0 && S_ISSOCK(socket_stat.st_mode))
+		unlink(m_SocketPath.c_str());
+
+	m_Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(m_Socket < 0)
+		throw DaemonException(std::string("Cannot create the socket: ") + strerror(errno));
+
+	// The requests write in any directory and load any classifier with the rights of the daemon,
+	// so only its owner can connect (the mode is set before listen(), so nobody connects before).
+	if(bind(m_Socket, reinterpret_cast< struct sockaddr* >(&address), sizeof(address)) != 0
+	|| chmod(m_SocketPath.c_str(), S_IRUSR | S_IWUSR) != 0
+	|| listen(m_Socket, SOMAXCONN) != 0)
+		throw DaemonException("Cannot listen on " + m_SocketPath + ": " + strerror(errno));
+
+	boost::thread_group workers;
+	for(unsigned int i = 0; i < m_NumberOfWorkers; ++i)
+		workers.add_thread(new boost::thread(&SegmentationDaemon::work, this));
+
+	LOG4CXX_INFO(logger, "Listening on " << m_SocketPath << " with " << m_NumberOfWorkers << " worker(s)");
+
+	for(;;)
+	{
+		const int connection = accept(m_Socket, NULL, NULL);
+
+		boost::unique_lock< boost::mutex > lock(m_Mutex);
+
+		if(m_Stopping) {
+			if(connection >= 0)
+				close(connection);
+			break;
+		}
+
+		if(connection < 0) {
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			LOG4CXX_ERROR(logger, "Cannot accept a connection: " << strerror(errno));
+			lock.unlock();
+			stop();
+			break;
+		}
+
+		m_Connections.insert(connection);
+		boost::thread(&SegmentationDaemon::serve, this, connection).detach();
+	}
+
+	LOG4CXX_INFO(logger, "Stopping, " << m_Queue.size() << " job(s) left in the queue");
+
+	// The workers segment the queued jobs before leaving.
+	workers.join_all();
+
+	{
+		// Wakes up the connections waiting for a request.
+		boost::unique_lock< boost::mutex > lock(m_Mutex);
+		for(std::set< int >::const_iterator it = m_Connections.begin(); it != m_Connections.end(); ++it)
+			shutdown(*it, SHUT_RD);
+
+		while(!m_Connections.empty())
+			m_JobCondition.wait(lock);
+	}
+
+	close(m_Socket);
+	m_Socket = -1;
+	unlink(m_SocketPath.c_str());
+
+	LOG4CXX_INFO(logger, "Stopped");
+}
+
+void SegmentationDaemon::stop()
+{
+	boost::lock_guard< boost::mutex > lock(m_Mutex);
+
+	m_Stopping = true;
+	m_QueueCondition.notify_all();
+
+	// Wakes up accept().
+	shutdown(m_Socket, SHUT_RDWR);
+}
+
+void SegmentationDaemon::work()
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	for(;;)
+	{
+		boost::shared_ptr< Job > job;
+
+		{
+			boost::unique_lock< boost::mutex > lock(m_Mutex);
+
+			while(m_Queue.empty() && !m_Stopping)
+				m_QueueCondition.wait(lock);
+
+			if(m_Queue.empty())
+				return;
+
+			job = m_Queue.front();
+			m_Queue.pop_front();
+
+			job->status = RUNNING;
+			job->queue_time = elapsed_time(job->submission, get_timestamp());
+			++m_NumberOfRunningJobs;
+		}
+
+		LOG4CXX_INFO(logger, "Job " << job->id << ": segmenting " << job->job.input_image);
+
+		SegmentationTimings timings = SegmentationTimings();
+		JobStatus status = DONE;
+		std::string error;
+
+		try {
+			const timestamp_t start = get_timestamp();
+			const SegmentationInput input = load_segmentation_input(job->job);
+			timings.loading = elapsed_time(start, get_timestamp());
+
+			segment(input, *(job->model.classifier), job->parameters, job->job.export_dir, &timings, job->model.classify_mutex.get());
+		} catch (std::exception &ex) {
+			status = FAILED;
+			error = ex.what();
+		}
+
+		boost::lock_guard< boost::mutex > lock(m_Mutex);
+
+		job->status = status;
+		job->error = error;
+		job->timings = timings;
+		job->total_time = elapsed_time(job->submission, get_timestamp());
+		// The model is released, so a replaced one can be freed.
+		job->model = Model();
+		--m_NumberOfRunningJobs;
+
+		if(status == DONE)
+			LOG4CXX_INFO(logger, "Job " << job->id << " done in " << job->total_time << "s");
+		else
+			LOG4CXX_ERROR(logger, "Job " << job->id << " failed: " << error);
+
+		m_FinishedJobs.push_back(job->id);
+		while(m_FinishedJobs.size() > MaxFinishedJobs) {
+			m_Jobs.erase(m_FinishedJobs.front());
+			m_FinishedJobs.pop_front();
+		}
+
+		m_JobCondition.notify_all();
+	}
+}
+
+void SegmentationDaemon::serve(const int connection)
+{
+	log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("main"));
+
+	std::string pending;
+	char buffer[4096];
+	bool shutdown = false;
+
+	while(!shutdown)
+	{
+		const ssize_t n = recv(connection, buffer, sizeof(buffer), 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+
+		pending.append(buffer, n);
+
+		size_t end;
+		while(!shutdown && (end = pending.find('\n')) != std::string::npos)
+		{
+			const std::string line = pending.substr(0, end);
+			pending.erase(0, end + 1);
+
+			if(line.find_first_not_of(" \t\r") == std::string::npos)
+				continue;
+
+			ptree response;
+			try {
+				std::istringstream input(line);
+				ptree request;
+				boost::property_tree::read_json(input, request);
+
+				response = handle(request, shutdown);
+			} catch (std::exception &ex) {
+				response.put("status", "error");
+				response.put("error", ex.what());
+			}
+
+			std::ostringstream output;
+			boost::property_tree::write_json(output, response, false);
+
+			if(!send_all(connection, output.str()))
+				break;
+		}
+
+		if(pending.size() > MaxRequestSize) {
+			LOG4CXX_WARN(logger, "Request too large, closing the connection");
+			break;
+		}
+	}
+
+	if(shutdown)
+		stop();
+
+	close(connection);
+
+	boost::lock_guard< boost::mutex > lock(m_Mutex);
+	m_Connections.erase(connection);
+	m_JobCondition.notify_all();
+}
+
+SegmentationDaemon::ptree SegmentationDaemon::handle(const ptree &request, bool &shutdown)
+{
+	const std::string command = request.get< std::string >("command", "");
+
+	if(command == "segment")
+		return submit(request);
+
+	if(command == "status")
+		return status();
+
+	if(command == "job") {
+		const unsigned long id = request.get< unsigned long >("job");
+
+		boost::lock_guard< boost::mutex > lock(m_Mutex);
+
+		std::map< unsigned long, boost::shared_ptr< Job > >::const_iterator it = m_Jobs.find(id);
+		if(it == m_Jobs.end())
+			throw DaemonException("Unknown job.");
+
+		return describe(*(it->second));
+	}
+
+	ptree response;
+
+	if(command == "load") {
+		loadModel(request.get< std::string >("model", "default"), request.get< std::string >("classifier_dir"), request.get< std::string >("classifier_type", "ann"));
+	} else if(command == "shutdown") {
+		shutdown = true;
+	} else {
+		throw DaemonException("Unknown command \"" + command + "\".");
+	}
+
+	response.put("status", "ok");
+	return response;
+}
+
+SegmentationDaemon::ptree SegmentationDaemon::submit(const ptree &request)
+{
+	boost::shared_ptr< Job > job(new Job);
+
+	job->job.input_image = request.get< std::string >("input_image");
+	job->job.region_of_interest = request.get< std::string >("roi", "");
+	job->job.export_dir = request.get< std::string >("export_dir");
+
+	job->parameters = m_Parameters;
+	job->parameters.number_of_iterations = request.get< int >("iterations", m_Parameters.number_of_iterations);
+	job->parameters.lambda = request.get< double >("lambda", m_Parameters.lambda);
+
+	if(job->parameters.number_of_iterations < 0)
+		throw DaemonException("The number of iterations cannot be negative.");
+
+	const std::string model_name = request.get< std::string >("model", "default");
+	{
+		boost::lock_guard< boost::mutex > lock(m_ModelsMutex);
+
+		std::map< std::string, Model >::const_iterator it = m_Models.find(model_name);
+		if(it == m_Models.end())
+			throw DaemonException("Unknown model \"" + model_name + "\".");
+
+		job->model = it->second;
+	}
+
+	const bool wait = request.get< bool >("wait", true);
+
+	boost::unique_lock< boost::mutex > lock(m_Mutex);
+
+	if(m_Stopping)
+		throw DaemonException("The daemon is stopping.");
+
+	job->id = m_NextJobId++;
+	job->status = QUEUED;
+	job->submission = get_timestamp();
+	job->queue_time = job->total_time = 0;
+	job->timings = SegmentationTimings();
+
+	m_Jobs[job->id] = job;
+	m_Queue.push_back(job);
+	m_QueueCondition.notify_one();
+
+	if(wait) {
+		while(job->status == QUEUED || job->status == RUNNING)
+			m_JobCondition.wait(lock);
+	}
+
+	return describe(*job);
+}
+
+SegmentationDaemon::ptree SegmentationDaemon::describe(const Job &job) const
+{
+	ptree response;
+	response.put("status", job_status_name(job.status));
+	response.put("job", job.id);
+
+	if(job.status == FAILED)
+		response.put("error", job.error);
+
+	if(job.status == DONE || job.status == FAILED) {
+		response.put("timings.queue",          job.queue_time);
+		response.put("timings.loading",        job.timings.loading);
+		response.put("timings.classification", job.timings.classification);
+		response.put("timings.waiting",        job.timings.waiting);
+		response.put("timings.regularization", job.timings.regularization);
+		response.put("timings.exports",        job.timings.exports);
+		response.put("timings.total",          job.total_time);
+	}
+
+	return response;
+}
+
+SegmentationDaemon::ptree SegmentationDaemon::status()
+{
+	ptree response;
+	response.put("status", "ok");
+
+	{
+		boost::lock_guard< boost::mutex > lock(m_Mutex);
+		response.put("queued", m_Queue.size());
+		response.put("running", m_NumberOfRunningJobs);
+		response.put("workers", m_NumberOfWorkers);
+	}
+
+	ptree models;
+	{
+		boost::lock_guard< boost::mutex > lock(m_ModelsMutex);
+		for(std::map< std::string, Model >::const_iterator it = m_Models.begin(); it != m_Models.end(); ++it)
+			models.push_back(std::make_pair("", ptree(it->first)));
+	}
+	response.add_child("models", models);
+
+	return response;
+}
@@ -0,0 +1,147 @@
+#ifndef SEGMENTATION_DAEMON_H
+#define SEGMENTATION_DAEMON_H
+
+#include "Classifier.h"
+#include "segmentation.h"
+#include "time_utils.h"
+
+#include "doublefann.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <stdexcept>
+
+class DaemonException : public std::runtime_error
+{
+public:
+	DaemonException ( const std::string &err ) : std::runtime_error(err) {}
+};
+
+/**
+ * \class SegmentationDaemon
+ *
+ * \brief Keeps classifiers loaded and segments the volumes requested on a Unix domain socket.
+ *
+ * Each request is a JSON object on a single line, and gets a JSON object on a single line as
+ * response (see the README for the commands). The jobs are queued and segmented by a pool of
+ * worker threads; a client connection is served by its own thread.
+ *
+ * A job holds the model it has been submitted with, so a model can be replaced (see
+ * setModel() and loadModel()) while it is in use: the jobs already submitted finish with the
+ * previous one.
+ *
+ * Tulip must have been initialized.
+ */
+class SegmentationDaemon : private boost::noncopyable
+{
+public:
+	/**
+	 * @param parameters The parameters of the jobs which do not override them.
+	 */
+	SegmentationDaemon(const std::string &socket_path, const unsigned int number_of_workers, const SegmentationParameters &parameters);
+
+	~SegmentationDaemon();
+
+	/** Registers a model, replacing the one with the same name (if any). */
+	void setModel(const std::string &name, boost::shared_ptr< Classifier<fann_type> > classifier);
+
+	/**
+	 * Loads a classifier from its configuration directory and registers it.
+	 *
+	 * @param classifier_type "ann" or "svm".
+	 *
+	 * \throw DaemonException if the classifier cannot be loaded.
+	 */
+	void loadModel(const std::string &name, const std::string &classifier_config_dir, const std::string &classifier_type);
+
+	/**
+	 * Serves the requests until a "shutdown" request. The queued jobs are segmented before returning.
+	 *
+	 * \throw DaemonException if the socket cannot be created.
+	 */
+	void run();
+
+private:
+	struct Model
+	{
+		boost::shared_ptr< Classifier<fann_type> > classifier;
+
+		/** Held while classifying with a classifier which is not thread safe (null otherwise). */
+		boost::shared_ptr< boost::mutex > classify_mutex;
+	};
+
+	enum JobStatus {
+		QUEUED,
+		RUNNING,
+		DONE,
+		FAILED
+	};
+
+	struct Job
+	{
+		unsigned long id;
+		SegmentationJob job;
+		SegmentationParameters parameters;
+		Model model;
+
+		JobStatus status;
+		std::string error;
+		timestamp_t submission;
+		float queue_time, total_time;
+		SegmentationTimings timings;
+	};
+
+	typedef boost::property_tree::ptree ptree;
+
+	void work();
+	void serve(const int connection);
+
+	/** Answers a request. Sets shutdown if the daemon has to stop. */
+	ptree handle(const ptree &request, bool &shutdown);
+
+	ptree submit(const ptree &request);
+	ptree describe(const Job &job) const;
+	ptree status();
+
+	/** Requests the end of run(). */
+	void stop();
+
+	std::string m_SocketPath;
+	unsigned int m_NumberOfWorkers;
+	SegmentationParameters m_Parameters;
+
+	int m_Socket;
+	bool m_Stopping;
+
+	boost::mutex m_ModelsMutex;
+	std::map< std::string, Model > m_Models;
+
+	/** Guards the jobs, the queue, the connections and m_Stopping. */
+	boost::mutex m_Mutex;
+
+	/** Notified when a job is queued or the daemon stops. */
+	boost::condition_variable m_QueueCondition;
+
+	/** Notified when a job ends or a connection is closed. */
+	boost::condition_variable m_JobCondition;
+
+	std::deque< boost::shared_ptr< Job > > m_Queue;
+	std::map< unsigned long, boost::shared_ptr< Job > > m_Jobs;
+
+	/** The finished jobs, oldest first, forgotten beyond MaxFinishedJobs. */
+	std::deque< unsigned long > m_FinishedJobs;
+	unsigned long m_NextJobId;
+	unsigned int m_NumberOfRunningJobs;
+
+	std::set< int > m_Connections;
+
+	static const size_t MaxFinishedJobs = 1024;
+};
+
+#endif /* SEGMENTATION_DAEMON_H */
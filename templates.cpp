@@ -34,12 +34,15 @@ template class itk::ImageFileReader< FeaturesImage >;
 template class itk::ImageSeriesReader< ImageType >;
 
 template class itk::Image< unsigned char, 2 >;
+template class itk::ImageFileReader< itk::Image< unsigned char, 2 > >;
 template class itk::ImageSeriesWriter< ImageType, itk::Image< unsigned char, 2 > >;
 
 template class itk::BinaryThresholdImageFilter< ImageType, ImageType >;
 
 template class itk::ImageRegionConstIteratorWithIndex< ImageType >;
 
+template class FeatureMatrix<fann_type>;
+template class FeatureScaler<fann_type>;
 template class ClassificationDataset<fann_type>;
 
 template class Classifier<fann_type>;